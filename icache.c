@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <string.h>
+#include "icache.h"
+
+/*
+ * Function headers I need
+ */
+int isPowerOf2(long x);
+
+/*
+ * Set up an I-cache. Everything starts out empty. Returns -1 if the geometry
+ * doesn't make sense or anything couldn't be allocated
+ */
+int icacheInit(icache *cache, const icache_config *settings) {
+	memset(cache, 0, sizeof(icache));
+	cache->settings = *settings;
+	if(icacheFillDefaults(&cache->settings) != 0)
+		return -1;
+
+	int lineSize = cache->settings.line_size;
+	int ways = cache->settings.ways;
+	cache->num_sets = (int)(((long)cache->settings.size_kb * 1024) / ((long)lineSize * ways));
+	cache->line_shift = 0;
+	while((1 << cache->line_shift) < lineSize)
+		cache->line_shift++;
+
+	long entries = (long)cache->num_sets * ways;
+	cache->tags = (uint64_t *)calloc(entries, sizeof(uint64_t));
+	cache->last_used = (uint64_t *)calloc(entries, sizeof(uint64_t));
+	if(cache->tags == NULL || cache->last_used == NULL)
+		return -1;
+	return 0;
+}
+
+/*
+ * Free everything icacheInit allocated
+ */
+void icacheFree(icache *cache) {
+	free(cache->tags);
+	free(cache->last_used);
+	memset(cache, 0, sizeof(icache));
+}
+
+/*
+ * Fill in the defaults for anything that wasn't given: 4 ways of 64 byte
+ * lines and a 10 cycle miss. The size has to be set since 0 means no I-cache.
+ * Returns -1 if the line size isn't a power of 2 or the number of sets
+ * wouldn't come out to one
+ */
+int icacheFillDefaults(icache_config *settings) {
+	if(settings->ways <= 0)
+		settings->ways = 4;
+	if(settings->line_size <= 0)
+		settings->line_size = 64;
+	if(settings->miss_latency <= 0)
+		settings->miss_latency = 10;
+	if(settings->size_kb <= 0)
+		return -1;
+
+	long lines = ((long)settings->size_kb * 1024) / settings->line_size;
+	if(!isPowerOf2(settings->line_size) || lines < settings->ways)
+		return -1;
+	return isPowerOf2(lines / settings->ways) ? 0 : -1;
+}
+
+int isPowerOf2(long x) {
+	return x > 0 && (x & (x - 1)) == 0;
+}
+
+/*
+ * Look up the line an address is in. Returns 1 on a hit. On a miss the least
+ * recently used way of the set gets the line, so the next access to it hits
+ */
+int icacheAccess(icache *cache, uint64_t address) {
+	uint64_t line = icacheLine(cache, address);
+	int ways = cache->settings.ways;
+	uint64_t *tags = &cache->tags[(line & (uint64_t)(cache->num_sets - 1)) * ways];
+	uint64_t *lastUsed = &cache->last_used[(line & (uint64_t)(cache->num_sets - 1)) * ways];
+	int victim = 0;
+
+	cache->now++;
+	cache->accesses++;
+	for(int i = 0; i < ways; i++) {
+		if(tags[i] == line + 1) {
+			lastUsed[i] = cache->now;
+			cache->hits++;
+			return 1;
+		}
+		if(lastUsed[i] < lastUsed[victim])
+			victim = i;
+	}
+
+	tags[victim] = line + 1;
+	lastUsed[victim] = cache->now;
+	return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef ICACHE_H
+#define ICACHE_H
+
+#include <inttypes.h>
+
+/**
+ * Geometry of the instruction cache. A size of 0 means there's no I-cache
+ * model at all (every fetch hits), and 0 for anything else means the default
+ */
+typedef struct icache_config_t {
+	int size_kb; // Total capacity in KB
+	int ways; // Associativity
+	int line_size; // Bytes per line. A power of 2
+	int miss_latency; // Cycles fetch waits on a miss
+} icache_config;
+
+/**
+ * A set associative cache of line addresses with LRU replacement. There's no
+ * data, only the tags, since all fetch needs to know is hit or miss. Every
+ * set is ways entries next to each other in the flat arrays
+ */
+typedef struct icache_t {
+	icache_config settings; // With the defaults filled in
+	int num_sets; // A power of 2
+	int line_shift; // log2 of the line size
+	uint64_t *tags; // Line address + 1 of each entry (0 means empty)
+	uint64_t *last_used; // When each entry was last hit or filled, for LRU
+	uint64_t now; // Counts accesses, so it's the LRU clock
+	int64_t accesses;
+	int64_t hits;
+} icache;
+
+int icacheInit(icache *cache, const icache_config *settings);
+void icacheFree(icache *cache);
+int icacheFillDefaults(icache_config *settings);
+int icacheAccess(icache *cache, uint64_t address);
+
+// Which line an address is in
+static inline uint64_t icacheLine(const icache *cache, uint64_t address) {
+	return address >> cache->line_shift;
+}
+
+#endif /* ICACHE_H */
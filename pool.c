@@ -0,0 +1,82 @@
+#include <stdlib.h>
+#include "pool.h"
+
+/*
+ * Function headers I need
+ */
+int poolGrow(node_pool *pool);
+
+/*
+ * Set up a pool for nodes of the given size and allocate the first chunk 
+ * right away so the common case never has to grow
+ */
+int poolInit(node_pool *pool, size_t node_size, size_t initial_nodes) {
+	// Every node has to be able to hold the free list pointer, and has to keep 
+	// the next node aligned
+	if(node_size < sizeof(void *))
+		node_size = sizeof(void *);
+	node_size = (node_size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+	
+	pool->free_list = NULL;
+	pool->chunks = NULL;
+	pool->node_size = node_size;
+	pool->next_chunk_nodes = (initial_nodes > 0) ? initial_nodes : 16;
+	return poolGrow(pool);
+}
+
+/*
+ * Helper function that allocates a new chunk and puts all of its nodes on 
+ * the free list
+ */
+int poolGrow(node_pool *pool) {
+	size_t numNodes = pool->next_chunk_nodes;
+	pool_chunk *chunk = (pool_chunk *)malloc(sizeof(pool_chunk) + pool->node_size * numNodes);
+	if(chunk == NULL)
+		return -1;
+	chunk->next = pool->chunks;
+	pool->chunks = chunk;
+	
+	// Push the nodes in reverse so they get handed out in address order
+	char *nodes = (char *)(chunk + 1);
+	for(size_t i = numNodes; i > 0; i--) {
+		void *node = nodes + (i - 1) * pool->node_size;
+		*(void **)node = pool->free_list;
+		pool->free_list = node;
+	}
+	pool->next_chunk_nodes = numNodes * 2;
+	return 0;
+}
+
+/*
+ * Get a node from the pool. Returns NULL only if the pool had to grow and 
+ * the allocation failed
+ */
+void *poolAlloc(node_pool *pool) {
+	if(pool->free_list == NULL && poolGrow(pool) != 0)
+		return NULL;
+	void *node = pool->free_list;
+	pool->free_list = *(void **)node;
+	return node;
+}
+
+/*
+ * Give a node back to the pool
+ */
+void poolFree(node_pool *pool, void *node) {
+	if(node == NULL)
+		return;
+	*(void **)node = pool->free_list;
+	pool->free_list = node;
+}
+
+/*
+ * Free every chunk. Any nodes that were still handed out go with them
+ */
+void poolDestroy(node_pool *pool) {
+	while(pool->chunks != NULL) {
+		pool_chunk *temp = pool->chunks;
+		pool->chunks = temp->next;
+		free(temp);
+	}
+	pool->free_list = NULL;
+}
@@ -0,0 +1,30 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+/**
+ * A free-list pool of fixed size nodes. Nodes are carved out of big chunks 
+ * and freed nodes go on a free list, so once the pool has grown to the most 
+ * nodes that are ever in flight at once there's no more heap allocation. 
+ * Each chunk is twice the size of the last one
+ */
+typedef union pool_chunk_u {
+	union pool_chunk_u *next; // Chunks are kept in a list so we can free them
+	uint64_t align; // Makes sure the nodes after the header are 8 byte aligned
+} pool_chunk;
+
+typedef struct node_pool_t {
+	void *free_list; // Freed nodes. The first word of each holds the next one
+	pool_chunk *chunks;
+	size_t node_size;
+	size_t next_chunk_nodes; // How many nodes the next chunk will have
+} node_pool;
+
+int poolInit(node_pool *pool, size_t node_size, size_t initial_nodes);
+void *poolAlloc(node_pool *pool);
+void poolFree(node_pool *pool, void *node);
+void poolDestroy(node_pool *pool);
+
+#endif /* POOL_H */
@@ -0,0 +1,369 @@
+#include <stdlib.h>
+#include <string.h>
+#include "predictor.h"
+
+#define TAGE_TAG_BITS 9
+
+/*
+ * Function headers I need
+ */
+uint64_t maskOf(int bits);
+void shiftHistory(branch_predictor *bp, int taken);
+uint64_t gselectIndex(branch_predictor *bp, uint64_t address);
+int gselectPredict(branch_predictor *bp, uint64_t address);
+void gselectUpdate(branch_predictor *bp, uint64_t address, int taken);
+uint64_t gshareIndex(branch_predictor *bp, uint64_t address);
+int gsharePredict(branch_predictor *bp, uint64_t address);
+void gshareUpdate(branch_predictor *bp, uint64_t address, int taken);
+int bimodalPredict(branch_predictor *bp, uint64_t address);
+void bimodalUpdate(branch_predictor *bp, uint64_t address, int taken);
+int tournamentPredict(branch_predictor *bp, uint64_t address);
+void tournamentUpdate(branch_predictor *bp, uint64_t address, int taken);
+uint64_t foldHistory(uint64_t history, int length, int bits);
+uint64_t tageIndex(branch_predictor *bp, int table, uint64_t address);
+uint16_t tageTag(branch_predictor *bp, int table, uint64_t address);
+int tageProvider(branch_predictor *bp, uint64_t address, int below);
+int tagePredict(branch_predictor *bp, uint64_t address);
+void tageUpdate(branch_predictor *bp, uint64_t address, int taken);
+
+/*
+ * Names used on the command line, in the same order as predictor_type
+ */
+static const char *predictorNames[] = {"gselect", "gshare", "bimodal", "tournament", "tage"};
+
+/*
+ * Set up a predictor. Every counter starts out at 1 (weakly not taken) like
+ * the original GSelect table did. Returns -1 if the geometry doesn't make
+ * sense or anything couldn't be allocated
+ */
+int predictorInit(branch_predictor *bp, const predictor_config *settings) {
+	memset(bp, 0, sizeof(branch_predictor));
+	bp->settings = *settings;
+	if(predictorFillDefaults(&bp->settings) != 0)
+		return -1;
+
+	int tableBits = bp->settings.table_bits;
+	int historyBits = bp->settings.history_bits;
+	bp->GHR = 0x0;
+	bp->history_mask = maskOf(historyBits);
+	bp->table_mask = maskOf(tableBits);
+
+	// GSelect has one counter for every (address, history) pair
+	uint64_t entries = (uint64_t)1 << tableBits;
+	if(bp->settings.type == PRED_GSELECT)
+		entries <<= historyBits;
+	bp->counters = counterTableAlloc(entries);
+	if(bp->counters == NULL)
+		return -1;
+
+	switch(bp->settings.type) {
+		case PRED_GSELECT:
+			bp->predict = gselectPredict;
+			bp->update = gselectUpdate;
+			break;
+		case PRED_GSHARE:
+			bp->predict = gsharePredict;
+			bp->update = gshareUpdate;
+			break;
+		case PRED_BIMODAL:
+			bp->predict = bimodalPredict;
+			bp->update = bimodalUpdate;
+			break;
+		case PRED_TOURNAMENT:
+			bp->local = counterTableAlloc(entries);
+			bp->chooser = counterTableAlloc(entries);
+			if(bp->local == NULL || bp->chooser == NULL)
+				return -1;
+			bp->predict = tournamentPredict;
+			bp->update = tournamentUpdate;
+			break;
+		case PRED_TAGE:
+			// The base table is just a bimodal table. The tagged tables double
+			// their history length each time, ending at the longest history
+			for(int i = 0; i < TAGE_TABLES; i++) {
+				bp->tage[i] = (tage_entry *)calloc(entries, sizeof(tage_entry));
+				if(bp->tage[i] == NULL)
+					return -1;
+				bp->tage_history[i] = historyBits >> (TAGE_TABLES - 1 - i);
+				if(bp->tage_history[i] < 1)
+					bp->tage_history[i] = 1;
+			}
+			bp->predict = tagePredict;
+			bp->update = tageUpdate;
+			break;
+		default:
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Free everything predictorInit allocated. Safe to call on a predictor that
+ * failed partway through predictorInit
+ */
+void predictorFree(branch_predictor *bp) {
+	free(bp->counters);
+	free(bp->local);
+	free(bp->chooser);
+	for(int i = 0; i < TAGE_TABLES; i++)
+		free(bp->tage[i]);
+	memset(bp, 0, sizeof(branch_predictor));
+}
+
+/*
+ * Turn a name from the command line into a predictor type. Returns -1 if
+ * there's no predictor by that name
+ */
+int predictorParseType(const char *name, predictor_type *type) {
+	for(int i = 0; i <= PRED_TAGE; i++) {
+		if(strcmp(name, predictorNames[i]) == 0) {
+			*type = (predictor_type)i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+const char *predictorName(predictor_type type) {
+	if(type < PRED_GSELECT || type > PRED_TAGE)
+		return "unknown";
+	return predictorNames[type];
+}
+
+/*
+ * Fill in the default geometry for anything left at 0 and check that the 
+ * tables aren't unreasonably big. Returns -1 if they are
+ */
+int predictorFillDefaults(predictor_config *settings) {
+	int tableBits, historyBits;
+	switch(settings->type) {
+		case PRED_GSELECT: // 128 x 8, the original table
+			tableBits = 7;
+			historyBits = 3;
+			break;
+		case PRED_GSHARE:
+		case PRED_TOURNAMENT:
+			tableBits = 12;
+			historyBits = 12;
+			break;
+		case PRED_BIMODAL:
+			tableBits = 12;
+			historyBits = 0;
+			break;
+		case PRED_TAGE:
+			tableBits = 10;
+			historyBits = 64;
+			break;
+		default:
+			return -1;
+	}
+	if(settings->table_bits <= 0)
+		settings->table_bits = tableBits;
+	if(settings->history_bits <= 0)
+		settings->history_bits = historyBits;
+
+	if(settings->table_bits > 24 || settings->history_bits > 64)
+		return -1;
+	if(settings->type == PRED_GSELECT && settings->table_bits + settings->history_bits > 28)
+		return -1;
+	return 0;
+}
+
+/*
+ * Helper function that gives the low bits set
+ */
+uint64_t maskOf(int bits) {
+	return (bits >= 64) ? ~(uint64_t)0 : (((uint64_t)1 << bits) - 1);
+}
+
+/*
+ * Allocate a packed counter table with every counter at 1 (weakly not taken)
+ */
+uint64_t *counterTableAlloc(uint64_t entries) {
+	uint64_t words = (entries + 31) >> 5;
+	uint64_t *table = (uint64_t *)malloc(sizeof(uint64_t) * words);
+	if(table == NULL)
+		return NULL;
+	for(uint64_t i = 0; i < words; i++)
+		table[i] = 0x5555555555555555ULL; // 01 in every counter
+	return table;
+}
+
+/*
+ * Helper function that shifts the branch outcome into the GHR
+ */
+void shiftHistory(branch_predictor *bp, int taken) {
+	if(taken == 1)
+		bp->GHR = ((bp->GHR << 1) | 1);
+	else if(taken == 0)
+		bp->GHR = (bp->GHR << 1);
+}
+
+/*
+ * GSelect. The row is picked by the address and the column by the history
+ */
+uint64_t gselectIndex(branch_predictor *bp, uint64_t address) {
+	uint64_t row = (address/4) & bp->table_mask;
+	uint64_t col = bp->GHR & bp->history_mask;
+	return (row << bp->settings.history_bits) | col;
+}
+
+int gselectPredict(branch_predictor *bp, uint64_t address) {
+	return counterGet(bp->counters, gselectIndex(bp, address)) >= 2;
+}
+
+void gselectUpdate(branch_predictor *bp, uint64_t address, int taken) {
+	counterTrain(bp->counters, gselectIndex(bp, address), taken);
+	shiftHistory(bp, taken);
+}
+
+/*
+ * gshare. Same kind of table but the address and history get xor'd together
+ */
+uint64_t gshareIndex(branch_predictor *bp, uint64_t address) {
+	return ((address/4) ^ (bp->GHR & bp->history_mask)) & bp->table_mask;
+}
+
+int gsharePredict(branch_predictor *bp, uint64_t address) {
+	return counterGet(bp->counters, gshareIndex(bp, address)) >= 2;
+}
+
+void gshareUpdate(branch_predictor *bp, uint64_t address, int taken) {
+	counterTrain(bp->counters, gshareIndex(bp, address), taken);
+	shiftHistory(bp, taken);
+}
+
+/*
+ * Bimodal. Just the address, the history is still kept for the others
+ */
+int bimodalPredict(branch_predictor *bp, uint64_t address) {
+	return counterGet(bp->counters, (address/4) & bp->table_mask) >= 2;
+}
+
+void bimodalUpdate(branch_predictor *bp, uint64_t address, int taken) {
+	counterTrain(bp->counters, (address/4) & bp->table_mask, taken);
+	shiftHistory(bp, taken);
+}
+
+/*
+ * Tournament. A gshare table and a bimodal table, and a chooser per address
+ * that learns which one to believe
+ */
+int tournamentPredict(branch_predictor *bp, uint64_t address) {
+	uint64_t local = (address/4) & bp->table_mask;
+	if(counterGet(bp->chooser, local) >= 2)
+		return counterGet(bp->counters, gshareIndex(bp, address)) >= 2;
+	return counterGet(bp->local, local) >= 2;
+}
+
+void tournamentUpdate(branch_predictor *bp, uint64_t address, int taken) {
+	uint64_t local = (address/4) & bp->table_mask;
+	uint64_t global = gshareIndex(bp, address);
+	int globalRight = ((counterGet(bp->counters, global) >= 2) == taken);
+	int localRight = ((counterGet(bp->local, local) >= 2) == taken);
+
+	// The chooser only learns when exactly one of them was right
+	if(globalRight != localRight)
+		counterTrain(bp->chooser, local, globalRight);
+	counterTrain(bp->counters, global, taken);
+	counterTrain(bp->local, local, taken);
+	shiftHistory(bp, taken);
+}
+
+/*
+ * Helper function that xors the newest length bits of history down to bits bits
+ */
+uint64_t foldHistory(uint64_t history, int length, int bits) {
+	history &= maskOf(length);
+	uint64_t folded = 0;
+	while(history != 0) {
+		folded ^= history & maskOf(bits);
+		history >>= bits;
+	}
+	return folded;
+}
+
+uint64_t tageIndex(branch_predictor *bp, int table, uint64_t address) {
+	int tableBits = bp->settings.table_bits;
+	uint64_t pc = address/4;
+	return (pc ^ (pc >> tableBits) ^ foldHistory(bp->GHR, bp->tage_history[table], tableBits)) & bp->table_mask;
+}
+
+uint16_t tageTag(branch_predictor *bp, int table, uint64_t address) {
+	int length = bp->tage_history[table];
+	uint64_t pc = address/4;
+	uint64_t tag = pc ^ foldHistory(bp->GHR, length, TAGE_TAG_BITS) ^ (foldHistory(bp->GHR, length, TAGE_TAG_BITS - 1) << 1);
+	// + 1 so it's never 0, which is what the empty (calloc'd) entries have
+	return (uint16_t)((tag & maskOf(TAGE_TAG_BITS)) + 1);
+}
+
+/*
+ * Helper function that finds the longest history table below table below whose
+ * tag matches. Returns -1 if none do (so the base table provides)
+ */
+int tageProvider(branch_predictor *bp, uint64_t address, int below) {
+	for(int i = below - 1; i >= 0; i--) {
+		if(bp->tage[i][tageIndex(bp, i, address)].tag == tageTag(bp, i, address))
+			return i;
+	}
+	return -1;
+}
+
+int tagePredict(branch_predictor *bp, uint64_t address) {
+	int provider = tageProvider(bp, address, TAGE_TABLES);
+	if(provider < 0)
+		return counterGet(bp->counters, (address/4) & bp->table_mask) >= 2;
+	return bp->tage[provider][tageIndex(bp, provider, address)].ctr >= 0;
+}
+
+/*
+ * TAGE update. The provider's counter learns the outcome, its useful counter
+ * learns whether it beat the next shorter match, and a miss grabs an entry in
+ * a longer history table so the next time around has more history to go on
+ */
+void tageUpdate(branch_predictor *bp, uint64_t address, int taken) {
+	uint64_t base = (address/4) & bp->table_mask;
+	int basePrediction = (counterGet(bp->counters, base) >= 2);
+	int provider = tageProvider(bp, address, TAGE_TABLES);
+	int prediction;
+
+	if(provider < 0) {
+		prediction = basePrediction;
+		counterTrain(bp->counters, base, taken);
+	} else {
+		tage_entry *entry = &bp->tage[provider][tageIndex(bp, provider, address)];
+		int alt = tageProvider(bp, address, provider);
+		int altPrediction = (alt < 0) ? basePrediction : (bp->tage[alt][tageIndex(bp, alt, address)].ctr >= 0);
+		prediction = (entry->ctr >= 0);
+
+		if(prediction != altPrediction) {
+			if(prediction == taken && entry->useful < 3)
+				entry->useful++;
+			else if(prediction != taken && entry->useful > 0)
+				entry->useful--;
+		}
+		if(taken == 1 && entry->ctr < 3)
+			entry->ctr++;
+		else if(taken == 0 && entry->ctr > -4)
+			entry->ctr--;
+	}
+
+	// Allocate in the first longer table with a free entry, or age them all
+	if(prediction != taken && provider < TAGE_TABLES - 1) {
+		int allocated = 0;
+		for(int i = provider + 1; i < TAGE_TABLES && !allocated; i++) {
+			tage_entry *entry = &bp->tage[i][tageIndex(bp, i, address)];
+			if(entry->useful == 0) {
+				entry->tag = tageTag(bp, i, address);
+				entry->ctr = (taken == 1) ? 0 : -1;
+				allocated = 1;
+			}
+		}
+		for(int i = provider + 1; i < TAGE_TABLES && !allocated; i++) {
+			tage_entry *entry = &bp->tage[i][tageIndex(bp, i, address)];
+			if(entry->useful > 0)
+				entry->useful--;
+		}
+	}
+	shiftHistory(bp, taken);
+}
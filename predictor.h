@@ -0,0 +1,96 @@
+#ifndef PREDICTOR_H
+#define PREDICTOR_H
+
+#include <inttypes.h>
+
+/**
+ * The branch predictors the simulator can use. They all sit behind the same
+ * two calls: predict when a branch gets to dispatch, and update (which also
+ * shifts the outcome into the global history) when the branch resolves
+ */
+typedef enum predictor_type_e {
+	PRED_GSELECT = 0, // Address bits concatenated with history bits (the original one)
+	PRED_GSHARE, // Address xor history
+	PRED_BIMODAL, // Address only
+	PRED_TOURNAMENT, // gshare and bimodal with a per-address chooser
+	PRED_TAGE // Bimodal base plus tagged tables with longer and longer histories
+} predictor_type;
+
+#define TAGE_TABLES 4
+
+/**
+ * Geometry of a predictor. 0 for either size means use the default for that
+ * predictor type
+ */
+typedef struct predictor_config_t {
+	predictor_type type;
+	int table_bits; // log2 of the number of entries in each table (GSelect: address bits)
+	int history_bits; // Global history bits used (TAGE: longest history)
+} predictor_config;
+
+// One entry of a TAGE tagged table
+typedef struct tage_entry_t {
+	uint16_t tag; // Tag + 1, 0 if nothing has been allocated here
+	int8_t ctr; // Signed 3 bit counter, taken if >= 0
+	uint8_t useful; // 2 bit usefulness counter
+} tage_entry;
+
+typedef struct branch_predictor_t {
+	predictor_config settings; // With the defaults filled in
+	uint64_t GHR; // Global history, newest outcome in bit 0
+	uint64_t history_mask;
+	uint64_t table_mask;
+	uint64_t *counters; // Packed 2 bit counters. The pattern table (tournament: the gshare side)
+	uint64_t *local; // Tournament bimodal side
+	uint64_t *chooser; // Tournament chooser, >= 2 means trust the gshare side
+	tage_entry *tage[TAGE_TABLES]; // TAGE tagged tables, shortest history first
+	int tage_history[TAGE_TABLES]; // History length of each tagged table
+
+	int (*predict)(struct branch_predictor_t *bp, uint64_t address);
+	void (*update)(struct branch_predictor_t *bp, uint64_t address, int taken);
+} branch_predictor;
+
+/*
+ * The 2 bit (Smith) counters are packed 32 to a word in one flat array, so 
+ * even a 1M entry table is only 256KB
+ */
+uint64_t *counterTableAlloc(uint64_t entries);
+
+static inline int counterGet(const uint64_t *table, uint64_t index) {
+	return (int)((table[index >> 5] >> ((index & 31) << 1)) & 3);
+}
+
+// Saturating update without any branches. Moves the counter one step towards 
+// the outcome unless it's already at that end
+static inline void counterTrain(uint64_t *table, uint64_t index, int taken) {
+	int shift = (int)((index & 31) << 1);
+	uint64_t *word = &table[index >> 5];
+	int counter = (int)((*word >> shift) & 3);
+	int up = taken & 1;
+	int next = counter + (up & (counter != 3)) - ((up ^ 1) & (counter != 0));
+	*word ^= (uint64_t)(counter ^ next) << shift;
+}
+
+int predictorInit(branch_predictor *bp, const predictor_config *settings);
+void predictorFree(branch_predictor *bp);
+int predictorFillDefaults(predictor_config *settings);
+int predictorParseType(const char *name, predictor_type *type);
+const char *predictorName(predictor_type type);
+
+// Just so callers don't have to go through the function pointers themselves
+static inline int predictorPredict(branch_predictor *bp, uint64_t address) {
+	return bp->predict(bp, address);
+}
+
+static inline void predictorUpdate(branch_predictor *bp, uint64_t address, int taken) {
+	bp->update(bp, address, taken);
+}
+
+// Predict and then train right away. Returns 1 if the prediction was right
+static inline int predictorStep(branch_predictor *bp, uint64_t address, int taken) {
+	int prediction = bp->predict(bp, address);
+	bp->update(bp, address, taken);
+	return prediction == taken;
+}
+
+#endif /* PREDICTOR_H */
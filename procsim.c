@@ -1,181 +1,398 @@
 #include "procsim.h"
 #include "assert.h"
 
-#define INT_MIN -2147483648
-#define INT_MAX 2147483647
-
-/*
- * Globals I need
- */
-dispatch_node *dispatch_head; // Dispatch queue
-schedule_node *schedule_head; // Scheduling queue
-final_node *final_head; // Final queue. Just stores completed instruction structs
-final_node *final_tail; // Final queue tail so we can append faster.
-instr **sup; // State update array. Of size r (number of common data buses)
-int schedule_size;
-int **reg_File; // Register file. It will hold ready and tag
-execute_node **k_0; // functional unit k_0. Array of instructions
-execute_node **k_1; // functional unit k_1. Array of instructions
-execute_node **k_2; // functional unit k_2. Array of instructions
-config *curr_Config; // Config structure that contains useful parameter constants
-uint64_t GHR; // Our GHR register
-uint64_t **GSelect; // Our GSelect apparatus. Stored as a 2D Array
-int stallDispatch; // A lock for our dispatch queue
-stats *myStats; // A struct for our stats to be stored in
 
 /*
  * Function headers I need
  */ 
-void proc_init(int numRegs, int k0_size, int k1_size, int k2_size, int num_r_bus, int fetch_rate);
-int stateEmpty();
-dispatch_node *getDispHead();
-schedule_node *getScheduleHead();
-void sendToFinal();
-void sendToSU(int clock);
-void resolveBranches();
-int findNumUnresolved();
-int getMinExecCycle();
-int getMinTagIndex(int cycle);
-void updateGSelect(uint64_t address, int taken);
-void updateSmithCounter(uint64_t row, uint64_t col, int taken);
-void updateGHR(int taken);
-void shiftTaken();
-void shiftNotTaken();
-void moveToExecute(int clock);
-void putInFU(instr *theInstr, int FU_num, int clock);
-void dispatchToSchedule(int clock, int totalMarked);
-void dispatch_Enqueue(if_listnode **fetch_head, int cycle);
-int getPrediction(uint64_t address);
-uint64_t getGHR();
-void writeToRegFile();
-void setToFired();
-int reserveScheduleSpots();
-void readUpdateRegFile(int totalMarked);
-void broadcastToSched();
-void removeAllSUFromSched();
-void removeFromSched(instr *theInstr);
-void setToChosen();
-int getNumPossible();
-execute_node *getMinNode();
-int findMinCycle();
-void markForExecution();
-int numSpotsAvailable(char FU);
-void markScheduleEntries(int openSpots, char FU);
-void printScheduleQueue();
-void printFinalQueue();
+int proc_init(proc_sim *sim, const config *settings);
+int inflightGrow(inflight_table *t, int capacity);
+void proc_free(proc_sim *sim);
+int stateEmpty(proc_sim *sim);
+int getDispSize(proc_sim *sim);
+int growDispatchQueue(dispatch_queue *q);
+int getScheduleSize(proc_sim *sim);
+int speculationEmpty(proc_sim *sim);
+int sendToFinal(proc_sim *sim);
+int commitFromROB(proc_sim *sim);
+int addToFinalWindow(proc_sim *sim, instr *theInstr);
+int growFinalWindow(proc_sim *sim, int64_t tag);
+void drainFinalWindow(proc_sim *sim);
+void sendToSU(proc_sim *sim, int64_t clock);
+int resolveBranches(proc_sim *sim, int64_t clock, if_listnode **fetch_head);
+int squashYounger(proc_sim *sim, instr *branch, if_listnode **fetch_head);
+void resetForReplay(proc_sim *sim, instr *theInstr);
+void rebuildRegFile(proc_sim *sim);
+void resetRegStatus(reg_status_table *rf);
+int findNumUnresolved(proc_sim *sim);
+int64_t doneCycle(proc_sim *sim, instr *theInstr);
+int64_t getMinDoneCycle(proc_sim *sim);
+int getMinTagIndex(proc_sim *sim, int64_t cycle);
+void moveToExecute(proc_sim *sim, int64_t clock);
+void putInFU(proc_sim *sim, instr *theInstr, int FU_num, int64_t clock);
+void dispatchToSchedule(proc_sim *sim, int64_t clock, int totalMarked);
+int dispatch_Enqueue(proc_sim *sim, if_listnode **fetch_head, int64_t cycle);
+int getPrediction(proc_sim *sim, uint64_t address);
+instr *replayNext(proc_sim *sim);
+fetch_result fetchInstr(proc_sim *sim, instr *theInstr, int64_t clock, int numFetched);
+int fetchHold(proc_sim *sim, instr *theInstr);
+void writeToRegFile(proc_sim *sim);
+void setToFired(proc_sim *sim);
+int reserveScheduleSpots(proc_sim *sim);
+int readUpdateRegFile(proc_sim *sim, int totalMarked);
+int addConsumer(proc_sim *sim, instr *producer, instr *consumer, int source);
+void broadcastToSched(proc_sim *sim);
+void broadcastToConsumers(proc_sim *sim);
+void broadcastMatchTags(proc_sim *sim);
+void removeAllSUFromSched(proc_sim *sim);
+void removeFromSched(proc_sim *sim, instr *theInstr);
+void schedDrop(proc_sim *sim, schedule_queue *q, int slot);
+int schedClassOf(int funcUnit);
+int schedInsert(proc_sim *sim, schedule_queue *q, instr *theInstr);
+int schedQueueInit(schedule_queue *q, int limit);
+int schedOccupancy(proc_sim *sim, int fuClass);
+void compactScheduleQueue(proc_sim *sim, schedule_queue *q);
+void setToChosen(proc_sim *sim, int64_t clock);
+int execBefore(execute_node *a, execute_node *b);
+void execHeapPush(proc_sim *sim, execute_node *node);
+execute_node *execHeapPop(proc_sim *sim);
+void markForExecution(proc_sim *sim);
+int numSpotsAvailable(proc_sim *sim, char FU);
+void markScheduleEntries(proc_sim *sim, int openSpots, char FU);
+void printScheduleQueue(proc_sim *sim);
+void printFinalHeader(proc_sim *sim);
+void printFinalQueue(proc_sim *sim);
 
 /*
  * Misc. Functions
  */
-void updateDispatchQueueSize();
-stats *getStats();
-void freeFinalQueue();
+void updateDispatchQueueSize(proc_sim *sim);
+int dispatchCanAccept(proc_sim *sim);
+int64_t getNextEventCycle(proc_sim *sim, int64_t clock);
+void skipIdleCycles(proc_sim *sim, int64_t numCycles);
+stats *getStats(proc_sim *sim);
+void freeFinalQueue(proc_sim *sim);
 
 /* 
  * Actual Functions written here
  */
  
 /*
- * This function just initializes the globals I need to run the simulation
+ * This function just initializes the simulator context with everything I need 
+ * to run the simulation. Returns -1 if anything couldn't be allocated
  */
-void proc_init(int numRegs, int k0_size, int k1_size, int k2_size, int num_r_bus, int fetch_rate) {
+int proc_init(proc_sim *sim, const config *settings) {
+	memset(sim, 0, sizeof(proc_sim));
 	
-	// Set my two queues to NULL for now. They'll fill up as instructions come in
-	dispatch_head = NULL;
-	schedule_head = NULL;
-	final_head = NULL;
-	final_tail = NULL;
+	// Copy over the parameters of the simulation
+	sim->curr_Config = *settings;
+
+	// Size the reservation stations. Unified is one scheduling queue of
+	// 2*(k0+k1+k2) entries and distributed is 2*k for each class, unless the
+	// config picked the sizes itself
+	int fuSizes[SCHED_FU_CLASSES] = {settings->k0_size, settings->k1_size, settings->k2_size};
+	int schedLimits[SCHED_FU_CLASSES] = {0, 0, 0};
+	if(settings->sched_distributed) {
+		sim->num_sched_queues = SCHED_FU_CLASSES;
+		for(int c = 0; c < SCHED_FU_CLASSES; c++)
+			schedLimits[c] = (settings->sched_size[c] > 0) ? settings->sched_size[c] : 2*fuSizes[c];
+	} else {
+		sim->num_sched_queues = 1;
+		schedLimits[0] = (settings->sched_size[0] > 0) ? settings->sched_size[0] :
+			2*(settings->k0_size + settings->k1_size + settings->k2_size);
+	}
+	sim->curr_Config.max_sched_queue = schedLimits[0] + schedLimits[1] + schedLimits[2];
+	for(int c = 0; c < SCHED_FU_CLASSES; c++) {
+		if(sim->curr_Config.fu_latency[c] <= 0)
+			return -1; // Every FU takes at least a cycle
+	}
+	int numRegs = sim->curr_Config.numRegs;
+	int num_r_bus = sim->curr_Config.num_r_bus;
 	
-	// Allocate space for my register file. It's (numRegs x 2) in dimension
-	reg_File = (int **)malloc(sizeof(int *) * numRegs);
-	if(reg_File == NULL)
-		return;
-	for(int i = 0; i < numRegs; i++) {
-		reg_File[i] = (int *)malloc(sizeof(int) * 2);
-		if(reg_File[i] == NULL) {
-			return;
-		} else {
-			reg_File[i][0] = 1; // Ready Bit
-			reg_File[i][1] = -5; // Tag. -5 is just going to be our default
+	// Retired instructions get printed to stdout unless the caller changes it
+	sim->final_out = stdout;
+	
+	// Size the node pools for what's normally in flight at once. The scheduling 
+	// queue and FUs can never hold more than this, the fetch queue can so its 
+	// pool will grow if it needs to
+	int numFUSlots = 0;
+	int max_sched_queue = sim->curr_Config.max_sched_queue;
+	int fetch_rate = settings->fetch_rate;
+	if(poolInit(&sim->instr_pool, sizeof(instr), max_sched_queue + num_r_bus + 4*fetch_rate) != 0 ||
+		poolInit(&sim->fetch_pool, sizeof(if_listnode), (settings->fetch_queue_size > 0) ? settings->fetch_queue_size : 2*fetch_rate) != 0 ||
+		poolInit(&sim->wakeup_pool, sizeof(wakeup_node), 2*max_sched_queue) != 0 ||
+		inflightGrow(&sim->inflight, max_sched_queue + num_r_bus + 4*fetch_rate) != 0)
+		return -1;
+	
+	// Set my two queues to empty for now. They'll fill up as instructions come in
+	sim->dispatch_q.limit = (settings->dispatch_queue_size > 0) ? settings->dispatch_queue_size : 0;
+	int dispatchSlots = (sim->dispatch_q.limit > 0) ? sim->dispatch_q.limit : max_sched_queue + 2*fetch_rate;
+	sim->dispatch_q.capacity = 1;
+	while(sim->dispatch_q.capacity < dispatchSlots)
+		sim->dispatch_q.capacity *= 2;
+	sim->dispatch_q.entries = (instr **)malloc(sizeof(instr *) * sim->dispatch_q.capacity);
+	if(sim->dispatch_q.entries == NULL)
+		return -1;
+	sim->dispatch_q.head = 0;
+	sim->dispatch_q.count = 0;
+	sim->dispatch_q.num_marked = 0;
+	
+	for(int i = 0; i < sim->num_sched_queues; i++) {
+		if(schedQueueInit(&sim->sched_q[i], schedLimits[i]) != 0)
+			return -1;
+	}
+	
+	// Nothing has retired yet
+	sim->final_window = NULL;
+	sim->final_window_size = 0;
+	sim->final_next_tag = 0;
+	sim->final_max_inst = 0;
+	sim->final_max_cycle = 0;
+	
+	// Allocate space for my register file. Every register starts out ready
+	if(numRegs <= 0)
+		return -1;
+	reg_status_table *rf = &sim->reg_status;
+	rf->num_regs = numRegs;
+	rf->ready = (uint64_t *)calloc((numRegs + 63) / 64, sizeof(uint64_t));
+	rf->tag = (int64_t *)malloc(sizeof(int64_t) * numRegs);
+	rf->producer = (instr **)calloc(numRegs, sizeof(instr *));
+	if(rf->ready == NULL || rf->tag == NULL || rf->producer == NULL)
+		return -1;
+	resetRegStatus(rf);
+	
+	// Allocate space for my functional units. Each class is just an array of 
+	// execute nodes (instructions + chosen flags) with a stack of the free ones
+	for(int c = 0; c < SCHED_FU_CLASSES; c++) {
+		func_unit *fu = &sim->k[c];
+		fu->size = fuSizes[c];
+		fu->latency = sim->curr_Config.fu_latency[c];
+		fu->pipelined = sim->curr_Config.fu_pipelined[c];
+		fu->num_slots = fu->pipelined ? fu->size * fu->latency : fu->size;
+		numFUSlots += fu->num_slots;
+		fu->slots = (execute_node *)calloc(fu->num_slots, sizeof(execute_node));
+		fu->free_slots = (int *)malloc(sizeof(int) * fu->num_slots);
+		if(fu->num_slots > 0 && (fu->slots == NULL || fu->free_slots == NULL))
+			return -1;
+		// Push them in reverse so the lowest slot gets used first
+		fu->num_free = 0;
+		for(int i = fu->num_slots - 1; i >= 0; i--) {
+			fu->slots[i].fu_class = c;
+			fu->slots[i].slot = i;
+			fu->free_slots[fu->num_free++] = i;
 		}
+		fu->occupied = 0;
+		fu->chosen = 0;
 	}
 	
-	// Allocate space for my k_0 functional unit. It's just an array of pointers
-	// to execute nodes (instructions + chosen flags)
-	k_0 = (execute_node **)malloc(sizeof(execute_node *) * k0_size);
-	if(k_0 == NULL) // Just allocate for now. We will fill them later
-		return;
-		
-	k_1 = (execute_node **)malloc(sizeof(execute_node *) * k1_size);
-	if(k_1 == NULL)
-		return;
+	// At most r entries get chosen each cycle
+	sim->chosen_list = (execute_node **)calloc(num_r_bus, sizeof(execute_node *));
+	if(sim->chosen_list == NULL)
+		return -1;
+	sim->num_chosen = 0;
 	
-	k_2 = (execute_node **)malloc(sizeof(execute_node *) * k2_size);
-	if(k_2 == NULL) 
-		return;	
+	// The heap can never hold more than every FU slot being full
+	sim->exec_heap = (execute_node **)calloc(numFUSlots + 1, sizeof(execute_node *));
+	if(sim->exec_heap == NULL)
+		return -1;
+	sim->exec_heap_size = 0;
 	
 	// Allocate space for my state update array. It will just hold the instructions
 	// from the execute stage
-	sup = (instr **)malloc(sizeof(instr *)*num_r_bus);
-	if(sup == NULL)
-		return;
+	sim->sup = (instr **)calloc(num_r_bus, sizeof(instr *));
+	sim->broadcast_tags = (int64_t *)calloc(num_r_bus, sizeof(int64_t));
+	if(sim->sup == NULL || sim->broadcast_tags == NULL)
+		return -1;
+	sim->wakeup_match = wakeupSelectKernel(); // Widest tag compare this CPU has
 	
-	// Allocate space for my curr_Config
-	curr_Config = malloc(sizeof(config)*1);
-	if(curr_Config == NULL)
-		return;
-	curr_Config->numRegs = numRegs;
-	curr_Config->k0_size = k0_size;
-	curr_Config->k1_size = k1_size;
-	curr_Config->k2_size = k2_size;
-	curr_Config->num_r_bus = num_r_bus;
-	curr_Config->max_sched_queue = 2*(k0_size + k1_size + k2_size);
-	curr_Config->fetch_rate = fetch_rate;
+	// Only tags that are still in the scheduling queue or state update can 
+	// retire out of order, so this many slots is normally enough. The window 
+	// will grow if it ever turns out not to be
+	if(sim->curr_Config.stats_only == 0) {
+		sim->final_window_size = sim->curr_Config.max_sched_queue + num_r_bus;
+		sim->final_window = (final_node *)calloc(sim->final_window_size, sizeof(final_node));
+		if(sim->final_window == NULL)
+			return -1;
+	}
 	
-	// Set the size of my scheduling queue to 0
-	schedule_size = 0;
+	// Set up the branch predictor (GSelect unless the config picked another)
+	if(predictorInit(&sim->predictor, &settings->predictor) != 0)
+		return -1;
 	
-	// Initialize GHR and Gselect Table
-	GHR = 0x0;
-	GSelect = (uint64_t **)malloc(sizeof(uint64_t *)*128);
-	if(GSelect == NULL)
-		return;
-	for(int i = 0; i < 128; i++) {
-		GSelect[i] = (uint64_t *)malloc(sizeof(uint64_t)*8);
-		if(GSelect[i] == NULL)
-			return;
+	// Initialize our stallDispatch lock
+	sim->stallDispatch = 0; // it starts out unlocked
+
+	// With a reorder buffer, mispredicted branches don't stall dispatch.
+	// Everything after them gets squashed when they resolve and goes through
+	// the replay queue to be fetched again
+	sim->rob.capacity = 1;
+	while(sim->rob.capacity < sim->curr_Config.rob_size)
+		sim->rob.capacity *= 2;
+	sim->rob.limit = sim->curr_Config.rob_size;
+	sim->rob.entries = (instr **)malloc(sizeof(instr *) * sim->rob.capacity);
+	sim->replay.capacity = 16;
+	sim->replay.entries = (instr **)malloc(sizeof(instr *) * sim->replay.capacity);
+	sim->replay_spare.capacity = 16;
+	sim->replay_spare.entries = (instr **)malloc(sizeof(instr *) * sim->replay_spare.capacity);
+	if(sim->rob.entries == NULL || sim->replay.entries == NULL || sim->replay_spare.entries == NULL)
+		return -1;
+	sim->fetch_resume = 0;
+	
+	// The I-cache starts out empty. Without one every fetch just hits
+	if(sim->curr_Config.icache.size_kb > 0 && icacheInit(&sim->icache, &settings->icache) != 0)
+		return -1;
+	sim->fetch_line = 0;
+	sim->fetch_miss_line = 0;
+	sim->fetch_miss_ready = 0;
+	
+	// Initialize our stats
+	sim->myStats.totalBranchInstr = 0;
+	sim->myStats.totalCorrectBranch = 0;
+	sim->myStats.predictionAcc = 0.0;
+	sim->myStats.avgDispQueue = 0.0;
+	sim->myStats.maxDispQueue = 0;
+	sim->myStats.avgInstIssue = 0.0;
+	sim->myStats.avgInstRet = 0.0;
+	sim->myStats.totalRuntime = 0;
+	sim->myStats.stallCycles = 0;
+	sim->myStats.icacheAccesses = 0;
+	sim->myStats.icacheHits = 0;
+	sim->myStats.icacheHitRate = 0.0;
+	sim->disp_queue_total = 0;
+	for(int c = 0; c < SCHED_FU_CLASSES; c++) {
+		sim->myStats.avgSchedOccupancy[c] = 0.0;
+		sim->myStats.maxSchedOccupancy[c] = 0;
+		sim->sched_occupancy_total[c] = 0;
 	}
-	for(int i = 0; i < 128; i++) {
-		for(int j = 0; j < 8; j++) {
-			GSelect[i][j] = 1; // Initialized at 1
-		}
+	return 0;
+}
+
+/*
+ * This function frees everything proc_init allocated, along with any 
+ * instructions that are still in flight. The context can be reused after this
+ */
+void proc_free(proc_sim *sim) {
+	// Every queue node and instruction came from the pools, so this takes 
+	// care of anything that's still in flight
+	poolDestroy(&sim->instr_pool);
+	poolDestroy(&sim->fetch_pool);
+	poolDestroy(&sim->wakeup_pool);
+	free(sim->inflight.free_ids);
+	free(sim->inflight.record);
+	free(sim->inflight.src_tag);
+	free(sim->inflight.fu_class);
+	free(sim->inflight.sched_slot);
+	free(sim->inflight.consumers);
+	free(sim->broadcast_tags);
+	
+	free(sim->dispatch_q.entries);
+	free(sim->rob.entries);
+	free(sim->replay.entries);
+	free(sim->replay_spare.entries);
+	for(int c = 0; c < SCHED_FU_CLASSES; c++) {
+		free(sim->sched_q[c].entries);
+		free(sim->sched_q[c].valid); // All of the bitmaps share one allocation
+		free(sim->sched_q[c].wait_tag[0]); // So do the tags
 	}
+	for(int c = 0; c < SCHED_FU_CLASSES; c++) {
+		free(sim->k[c].slots);
+		free(sim->k[c].free_slots);
+	}
+	free(sim->chosen_list);
+	free(sim->exec_heap);
 	
-	// Initialize our stallDispatch lock
-	stallDispatch = 0; // it starts out unlocked
+	free(sim->sup);
 	
-	// Initialize our stats
-	myStats = (stats *)malloc(sizeof(stats)*1);
-	if(myStats == NULL)
-		return;
-	myStats->totalBranchInstr = 0;
-	myStats->totalCorrectBranch = 0;
-	myStats->predictionAcc = 0.0;
-	myStats->avgDispQueue = 0.0;
-	myStats->maxDispQueue = 0;
-	myStats->avgInstIssue = 0.0;
-	myStats->avgInstRet = 0.0;
-	myStats->totalRuntime = 0;
+	free(sim->reg_status.ready);
+	free(sim->reg_status.tag);
+	free(sim->reg_status.producer);
+	predictorFree(&sim->predictor);
+	icacheFree(&sim->icache);
+	
+	freeFinalQueue(sim);
+	memset(sim, 0, sizeof(proc_sim));
+}
+
+// Put an in-flight table entry back to how a new instruction starts out
+static inline void inflightReset(inflight_table *t, int id) {
+	t->src_tag[2*id] = -5; // -5 is just a placeholder
+	t->src_tag[2*id + 1] = -5;
+	t->fu_class[id] = -1;
+	t->sched_slot[id] = -1;
+	t->consumers[id] = NULL;
+}
+
+/*
+ * Helper function that makes the in-flight table big enough for capacity 
+ * instructions. The new ids go on the free stack so the lowest ones get 
+ * handed out first
+ */
+int inflightGrow(inflight_table *t, int capacity) {
+	if(capacity <= t->capacity)
+		return 0;
+	
+	int *freeIds = (int *)realloc(t->free_ids, sizeof(int) * capacity);
+	if(freeIds != NULL)
+		t->free_ids = freeIds;
+	instr **record = (instr **)realloc(t->record, sizeof(instr *) * capacity);
+	if(record != NULL)
+		t->record = record;
+	int64_t *srcTag = (int64_t *)realloc(t->src_tag, sizeof(int64_t) * 2 * capacity);
+	if(srcTag != NULL)
+		t->src_tag = srcTag;
+	int8_t *fuClass = (int8_t *)realloc(t->fu_class, sizeof(int8_t) * capacity);
+	if(fuClass != NULL)
+		t->fu_class = fuClass;
+	int32_t *schedSlot = (int32_t *)realloc(t->sched_slot, sizeof(int32_t) * capacity);
+	if(schedSlot != NULL)
+		t->sched_slot = schedSlot;
+	wakeup_node **consumers = (wakeup_node **)realloc(t->consumers, sizeof(wakeup_node *) * capacity);
+	if(consumers != NULL)
+		t->consumers = consumers;
+	if(freeIds == NULL || record == NULL || srcTag == NULL || fuClass == NULL || 
+		schedSlot == NULL || consumers == NULL)
+		return -1;
+	
+	for(int id = capacity - 1; id >= t->capacity; id--)
+		t->free_ids[t->num_free++] = id;
+	t->capacity = capacity;
+	return 0;
+}
+
+/*
+ * Get a new instruction. The instr itself comes from the pool and it gets an 
+ * id in the in-flight table for its wakeup/select state. Both are given back 
+ * by instrFree once it retires
+ */
+instr *instrAlloc(proc_sim *sim) {
+	inflight_table *t = &sim->inflight;
+	if(t->num_free == 0 && inflightGrow(t, 2*t->capacity) != 0)
+		return NULL;
+	instr *theInstr = (instr *)poolAlloc(&sim->instr_pool);
+	if(theInstr == NULL)
+		return NULL;
+	
+	theInstr->id = t->free_ids[--t->num_free];
+	t->record[theInstr->id] = theInstr;
+	inflightReset(t, theInstr->id);
+	return theInstr;
+}
+
+void instrFree(proc_sim *sim, instr *theInstr) {
+	inflight_table *t = &sim->inflight;
+	t->record[theInstr->id] = NULL;
+	t->free_ids[t->num_free++] = theInstr->id;
+	poolFree(&sim->instr_pool, theInstr);
 }
 
 /*
  * Function that checks if all of the state update array is empty or not
  */
-int stateEmpty() {
-	int numEntries = curr_Config->num_r_bus;
+int stateEmpty(proc_sim *sim) {
+	int numEntries = sim->curr_Config.num_r_bus;
 	
 	for(int i = 0; i < numEntries; i++) {
-		if(sup[i] != NULL) {
+		if(sim->sup[i] != NULL) {
 			return 0;
 		}
 	}
@@ -183,261 +400,682 @@ int stateEmpty() {
 }
 
 /*
- * Just returns the address of the dispatch head so that the driver knows 
- * when to stop the simulation
+ * Just returns the number of instructions in the dispatch queue so that the 
+ * driver knows when to stop the simulation
  */
-dispatch_node *getDispHead() {
-	return dispatch_head;
+int getDispSize(proc_sim *sim) {
+	return sim->dispatch_q.count;
 }
 
 /*
- * Just returns the address of the schedule head so the driver knows when 
- * to stop the simulation
+ * Helper function to get the i'th oldest instruction in the dispatch queue
  */
-schedule_node *getScheduleHead() {
-	return schedule_head;
+static inline instr *dispatchAt(dispatch_queue *q, int i) {
+	return q->entries[(q->head + i) & (q->capacity - 1)];
 }
 
 /*
- * This function is a new send to final. It create a new node that deletes a lot
- * of the unnecessary data and it stores everything in sorted order rather
- * than just appending to the end of a queue
+ * Helper function that doubles the size of the dispatch queue when it's full. 
+ * The instructions get unwrapped so the oldest one is at index 0 again
  */
-void sendToFinal() {
-	int i;
-	for(i = 0; i < curr_Config->num_r_bus; i++) {
-		if(sup[i] != NULL) {
-			
-			// Create a new final node that just stores useful information
-			// that we need for output
-			final_node *newNode = (final_node *)malloc(sizeof(final_node)*1);
-			if(newNode == NULL)
-				return;
-			newNode->dest_tag = sup[i]->dest_tag;
-			newNode->fetch = sup[i]->fetch;
-			newNode->disp = sup[i]->disp;
-			newNode->sched = sup[i]->sched;
-			newNode->exec = sup[i]->exec;
-			newNode->state = sup[i]->state;
-			newNode->next = NULL;
-			
-			if(final_head == NULL) {
-				final_head = newNode;
-				final_tail = newNode;
-			} else {
-				final_tail->next = newNode;
-				final_tail = newNode;
-			}
-			
-			// Free the memory for the instruction struct we had
-			free(sup[i]);
-			sup[i] = NULL;
-		}
+int growDispatchQueue(dispatch_queue *q) {
+	int newCapacity = q->capacity * 2;
+	instr **newEntries = (instr **)malloc(sizeof(instr *) * newCapacity);
+	if(newEntries == NULL)
+		return -1;
+	for(int i = 0; i < q->count; i++)
+		newEntries[i] = dispatchAt(q, i);
+	free(q->entries);
+	q->entries = newEntries;
+	q->capacity = newCapacity;
+	q->head = 0;
+	return 0;
+}
+
+/*
+ * Helper function to add an instruction to the end of a ring buffer (the
+ * dispatch queue, the ROB or the replay queue), growing it if it's full
+ */
+static inline int ringPush(instr_ring *q, instr *theInstr) {
+	if(q->count == q->capacity && growDispatchQueue(q) != 0)
+		return -1;
+	q->entries[(q->head + q->count) & (q->capacity - 1)] = theInstr;
+	q->count++;
+	return 0;
+}
+
+/*
+ * Just returns the number of entries in the scheduling queue so the driver 
+ * knows when to stop the simulation
+ */
+int getScheduleSize(proc_sim *sim) {
+	int count = 0;
+	for(int i = 0; i < sim->num_sched_queues; i++)
+		count += sim->sched_q[i].count;
+	return count;
+}
+
+/*
+ * Checks that nothing is waiting to commit or to be fetched again. Always true
+ * without a ROB
+ */
+int speculationEmpty(proc_sim *sim) {
+	return (sim->rob.count == 0) && (sim->replay.count == 0);
+}
+
+/*
+ * Helpers for the scheduling queue bitmaps
+ */
+static inline void bitSet(uint64_t *map, int i) {
+	map[i >> 6] |= (1ULL << (i & 63));
+}
+
+static inline void bitClear(uint64_t *map, int i) {
+	map[i >> 6] &= ~(1ULL << (i & 63));
+}
+
+static inline int bitTest(const uint64_t *map, int i) {
+	return (map[i >> 6] >> (i & 63)) & 1;
+}
+
+// Point a register at the in-flight instruction that's going to write it
+static inline void regRename(reg_status_table *rf, int reg, instr *producer) {
+	bitClear(rf->ready, reg);
+	rf->tag[reg] = producer->dest_tag;
+	rf->producer[reg] = producer;
+}
+
+// Number of bitmap words that can have anything set in them
+static inline int schedWordsUsed(const schedule_queue *q) {
+	return (q->tail + 63) >> 6;
+}
+
+/*
+ * Helper function to map an instruction's FU type to its FU class. 1 and -1 
+ * both run on the type 1 FUs. Returns -1 for anything else
+ */
+int schedClassOf(int funcUnit) {
+	switch(funcUnit) {
+		case 0:
+			return 0;
+		case 1:
+		case -1:
+			return 1;
+		case 2:
+			return 2;
+		default:
+			return -1;
 	}
-	return;
 }
 
 /*
- * This function just sends all the 'chosen' instructions from the FU to the 
- * state update array and then nulls out that FU entry
+ * Helper function to get the scheduling queue an FU class's instructions go in
  */
-void sendToSU(int clock) {
-	int index = 0;
-	int i;
+static inline schedule_queue *schedQueueFor(proc_sim *sim, int fuClass) {
+	if(sim->num_sched_queues == 1)
+		return &sim->sched_q[0];
+	return &sim->sched_q[fuClass];
+}
+
+/*
+ * Helper function that sets up an empty scheduling queue that can hold limit
+ * entries. It gets twice as many slots as that, so the holes left by removed
+ * entries only need squeezing out once in a while
+ */
+int schedQueueInit(schedule_queue *q, int limit) {
+	q->limit = limit;
+	q->capacity = ((2*limit + 63) / 64) * 64;
+	if(q->capacity == 0)
+		q->capacity = 64;
+	q->words = q->capacity / 64;
+	q->tail = 0;
+	q->count = 0;
+	for(int c = 0; c < SCHED_FU_CLASSES; c++)
+		q->class_count[c] = 0;
+	q->entries = (instr **)calloc(q->capacity, sizeof(instr *));
+	uint64_t *bitmaps = (uint64_t *)calloc(q->words * SCHED_NUM_MAPS, sizeof(uint64_t));
+	int64_t *tags = (int64_t *)malloc(sizeof(int64_t) * 2 * q->capacity);
+	if(q->entries == NULL || bitmaps == NULL || tags == NULL) {
+		free(q->entries);
+		free(bitmaps);
+		free(tags);
+		q->entries = NULL;
+		return -1;
+	}
+	q->valid = bitmaps;
+	q->fired = bitmaps + q->words;
+	q->sendToExecute = bitmaps + 2*q->words;
+	q->waiting = bitmaps + 3*q->words;
+	q->newly_ready = bitmaps + 4*q->words;
+	q->src_ready[0] = bitmaps + 5*q->words;
+	q->src_ready[1] = bitmaps + 6*q->words;
+	for(int c = 0; c < SCHED_FU_CLASSES; c++)
+		q->fu_class[c] = bitmaps + (7 + c)*q->words;
 	
-	for(i = 0; i < curr_Config->k0_size; i++) {
-		if(k_0[i] != NULL && k_0[i]->chosen == 1) {
-			sup[index] = k_0[i]->theInstr;
-			sup[index]->state = clock;
-			index++;
-			free(k_0[i]);
-			k_0[i] = NULL;
-		}
+	// Only the slots with a source still waiting ever get compared, so the 
+	// tags of empty slots don't matter
+	q->wait_tag[0] = tags;
+	q->wait_tag[1] = tags + q->capacity;
+	return 0;
+}
+
+/*
+ * Helper function that puts an instruction in the next slot of the scheduling 
+ * queue, which is always the youngest. Returns the slot
+ */
+int schedInsert(proc_sim *sim, schedule_queue *q, instr *theInstr) {
+	inflight_table *t = &sim->inflight;
+	if(q->tail == q->capacity)
+		compactScheduleQueue(sim, q);
+	assert(q->tail < q->capacity);
+	
+	int slot = q->tail++;
+	q->entries[slot] = theInstr;
+	t->sched_slot[theInstr->id] = slot;
+	bitSet(q->valid, slot);
+	int fuClass = schedClassOf(theInstr->funcUnit);
+	t->fu_class[theInstr->id] = fuClass;
+	if(fuClass >= 0) {
+		bitSet(q->fu_class[fuClass], slot);
+		q->class_count[fuClass]++;
 	}
 	
-	for(i = 0; i < curr_Config->k1_size; i++) {
-		if(k_1[i] != NULL && k_1[i]->chosen == 1) {
-			sup[index] = k_1[i]->theInstr;
-			sup[index]->state = clock;
-			index++;
-			free(k_1[i]);
-			k_1[i] = NULL;
-		}
+	// What dispatch read from the register file moves into the queue, and 
+	// from here on the broadcast keeps it up to date
+	int w = slot >> 6;
+	uint64_t bit = 1ULL << (slot & 63);
+	uint64_t bothReady = bit;
+	for(int src = 0; src < 2; src++) {
+		q->wait_tag[src][slot] = t->src_tag[2*theInstr->id + src];
+		if(q->wait_tag[src][slot] == -5)
+			q->src_ready[src][w] |= bit;
+		else
+			bothReady = 0;
 	}
+	q->newly_ready[w] |= bothReady;
+	q->count++;
+	return slot;
+}
+
+/*
+ * Helper function that squeezes the holes out of the scheduling queue. Live 
+ * entries slide down in order, so the slots stay in age order
+ */
+void compactScheduleQueue(proc_sim *sim, schedule_queue *q) {
+	uint64_t *maps[SCHED_NUM_MAPS] = {q->valid, q->fired, q->sendToExecute, 
+		q->waiting, q->newly_ready, q->src_ready[0], q->src_ready[1], q->fu_class[0], 
+		q->fu_class[1], q->fu_class[2]};
+	int numMaps = SCHED_NUM_MAPS;
+	int newSlot = 0;
 	
-	for(i = 0; i < curr_Config->k2_size; i++) {
-		if(k_2[i] != NULL && k_2[i]->chosen == 1) {
-			sup[index] = k_2[i]->theInstr;
-			sup[index]->state = clock;
-			index++;
-			free(k_2[i]);
-			k_2[i] = NULL;
+	for(int slot = 0; slot < q->tail; slot++) {
+		if(!bitTest(q->valid, slot))
+			continue;
+		if(slot != newSlot) {
+			q->entries[newSlot] = q->entries[slot];
+			sim->inflight.sched_slot[q->entries[newSlot]->id] = newSlot;
+			q->entries[slot] = NULL;
+			q->wait_tag[0][newSlot] = q->wait_tag[0][slot];
+			q->wait_tag[1][newSlot] = q->wait_tag[1][slot];
+			// newSlot is a hole or was already moved, so all its bits are clear
+			for(int m = 0; m < numMaps; m++) {
+				if(bitTest(maps[m], slot)) {
+					bitSet(maps[m], newSlot);
+					bitClear(maps[m], slot);
+				}
+			}
 		}
+		newSlot++;
 	}
-	return;
+	assert(newSlot == q->count);
+	q->tail = newSlot;
 }
 
 /*
- * Look through what was just moved to state update and resolve them in tag order
+ * This function retires everything in state update. The stats we need at the 
+ * end are kept up to date here, and unless we're in stats only mode each 
+ * instruction goes into the reorder window so it can be printed as soon as all 
+ * of the lower tags have retired. Returns -1 if the window couldn't grow
  */
-void resolveBranches() {
-	int numUnresolved = findNumUnresolved();
-	while(numUnresolved > 0) {
-		int cycle = getMinExecCycle();
-		int index = getMinTagIndex(cycle);
-		
-		// First update GSelect
-		updateGSelect(sup[index]->address, sup[index]->taken);
+int sendToFinal(proc_sim *sim) {
+	int i;
 
-		// Then update GHR
-		updateGHR(sup[index]->taken);
+	// With a ROB the instructions stay put until they commit in order
+	if(sim->curr_Config.rob_size > 0) {
+		for(i = 0; i < sim->curr_Config.num_r_bus; i++)
+			sim->sup[i] = NULL;
+		return commitFromROB(sim);
+	}
 
-		if(sup[index]->correct_pred == 0) {
-			assert(stallDispatch == 1); // Has to be true
-			// But now we resolved so we can set stall dispatch to 0
-			stallDispatch = 0;
+	for(i = 0; i < sim->curr_Config.num_r_bus; i++) {
+		if(sim->sup[i] != NULL) {
+			
+			if(sim->sup[i]->dest_tag + 1 > sim->final_max_inst)
+				sim->final_max_inst = sim->sup[i]->dest_tag + 1;
+			if(sim->sup[i]->state > sim->final_max_cycle)
+				sim->final_max_cycle = sim->sup[i]->state;
+			
+			if(sim->curr_Config.stats_only == 0 && addToFinalWindow(sim, sim->sup[i]) != 0)
+				return -1;
+			
+			// Give the instruction struct back to the pool
+			instrFree(sim, sim->sup[i]);
+			sim->sup[i] = NULL;
 		}
-		
-		// mark as resolved
-		sup[index]->resolved = 1;
-		
-		// decrement 
-		numUnresolved--;
 	}
+	
+	if(sim->curr_Config.stats_only == 0)
+		drainFinalWindow(sim);
+	return 0;
 }
 
 /*
- * Look through the state update array and find the number of branches in it
- * that are unresolved
+ * Commit up to F finished instructions from the head of the ROB. This is
+ * where branches train the predictor and count towards the prediction stats,
+ * since a branch that got squashed and fetched again only counts once
  */
-int findNumUnresolved() {
-	int i;
-	int numUnresolved = 0;
-	for(i = 0; i < curr_Config->num_r_bus; i++) {
-		if(sup[i] == NULL)
-			continue;
-		if(sup[i]->resolved == 0) {
-			assert(sup[i]->branch == 1); // had to be a branch
-			numUnresolved++;
+int commitFromROB(proc_sim *sim) {
+	instr_ring *rob = &sim->rob;
+	int numCommitted = 0;
+
+	while(rob->count > 0 && numCommitted < sim->curr_Config.fetch_rate) {
+		instr *head = dispatchAt(rob, 0);
+		if(head->state == 0)
+			break; // Hasn't been through state update yet
+
+		if(head->dest_tag + 1 > sim->final_max_inst)
+			sim->final_max_inst = head->dest_tag + 1;
+		if(head->state > sim->final_max_cycle)
+			sim->final_max_cycle = head->state;
+		if(head->branch == 1) {
+			(sim->myStats.totalBranchInstr)++;
+			if(head->correct_pred == 1)
+				(sim->myStats.totalCorrectBranch)++;
+			predictorUpdate(&sim->predictor, head->address, head->taken);
 		}
+		if(sim->curr_Config.stats_only == 0 && addToFinalWindow(sim, head) != 0)
+			return -1;
+
+		instrFree(sim, head);
+		rob->head = (rob->head + 1) & (rob->capacity - 1);
+		rob->count--;
+		numCommitted++;
 	}
-	return numUnresolved;
+
+	if(sim->curr_Config.stats_only == 0)
+		drainFinalWindow(sim);
+	return 0;
 }
 
 /*
- * Get the min cycle the instructions entered exec. This relative ordering is the
- * same as the order in which they left exec
+ * Helper function that copies the useful output information of a retired 
+ * instruction into its slot in the reorder window. Returns -1 if the window 
+ * had to grow and couldn't
  */
-int getMinExecCycle() {
-	int i;
-	int minCycle = INT_MAX;
-	for(i = 0; i < curr_Config->num_r_bus; i++) {
-		if(sup[i] == NULL)
-			continue;
-		if((sup[i]->resolved == 0) && (sup[i]->exec < minCycle)) {
-			minCycle = sup[i]->exec;
-		}
+int addToFinalWindow(proc_sim *sim, instr *theInstr) {
+	if(theInstr->dest_tag - sim->final_next_tag >= sim->final_window_size && 
+		growFinalWindow(sim, theInstr->dest_tag) != 0)
+		return -1;
+	
+	final_node *slot = &sim->final_window[theInstr->dest_tag % sim->final_window_size];
+	assert(slot->valid == 0);
+	slot->fetch = theInstr->fetch;
+	slot->disp = theInstr->disp;
+	slot->sched = theInstr->sched;
+	slot->exec = theInstr->exec;
+	slot->state = theInstr->state;
+	slot->valid = 1;
+	return 0;
+}
+
+/*
+ * Helper function that makes the reorder window big enough to hold the given 
+ * tag. The entries that are already waiting get moved to their new slots. 
+ * Returns -1 if the new window couldn't be allocated
+ */
+int growFinalWindow(proc_sim *sim, int64_t tag) {
+	int newSize = sim->final_window_size * 2;
+	while(tag - sim->final_next_tag >= newSize)
+		newSize *= 2;
+	
+	final_node *newWindow = (final_node *)calloc(newSize, sizeof(final_node));
+	if(newWindow == NULL)
+		return -1;
+	for(int64_t t = sim->final_next_tag; t < sim->final_next_tag + sim->final_window_size; t++) {
+		newWindow[t % newSize] = sim->final_window[t % sim->final_window_size];
 	}
-	return minCycle;
+	free(sim->final_window);
+	sim->final_window = newWindow;
+	sim->final_window_size = newSize;
+	return 0;
 }
 
 /*
- * Look through state update array and get the index of the branch instruction
- * that is unresolved with the lowest tag
+ * Helper function that prints everything at the front of the reorder window 
+ * that is now in tag order and frees up those slots
  */
-int getMinTagIndex(int cycle) {
-	int i;
-	int minTag = INT_MAX;
-	int minIndex = -1;
-	for(i = 0; i < curr_Config->num_r_bus; i++) {
-		if(sup[i] == NULL)
-			continue;
-		if((sup[i]->resolved == 0) && (sup[i]->dest_tag < minTag) && (sup[i]->exec == cycle)) {
-			minIndex = i;
-			minTag = sup[i]->dest_tag;
-		}
+void drainFinalWindow(proc_sim *sim) {
+	final_node *slot = &sim->final_window[sim->final_next_tag % sim->final_window_size];
+	while(slot->valid == 1) {
+		fprintf(sim->final_out, "%" PRId64 "\t%" PRId64 "\t%" PRId64 "\t%" PRId64 "\t%" PRId64 "\t%" PRId64 "\t\n", 
+			sim->final_next_tag+1, slot->fetch, slot->disp, slot->sched, slot->exec, slot->state);
+		slot->valid = 0;
+		sim->final_next_tag++;
+		slot = &sim->final_window[sim->final_next_tag % sim->final_window_size];
 	}
-	return minIndex;
+	return;
 }
 
 /*
- * This helper function updates the GSelect Smith Counter
+ * This function just sends all the 'chosen' instructions from the FU to the 
+ * state update array and then frees up those FU slots
  */
-void updateGSelect(uint64_t address, int taken) {
-	uint64_t row = (address/4)%128;
-	uint64_t col = getGHR();
-	updateSmithCounter(row, col, taken);
+void sendToSU(proc_sim *sim, int64_t clock) {
+	int index;
+	
+	for(index = 0; index < sim->num_chosen; index++) {
+		execute_node *node = sim->chosen_list[index];
+		func_unit *fu = &sim->k[node->fu_class];
+		
+		sim->sup[index] = node->theInstr;
+		sim->sup[index]->state = clock;
+		
+		// Then just give the slot back to its FU class
+		node->theInstr = NULL;
+		node->chosen = 0;
+		fu->free_slots[fu->num_free++] = node->slot;
+		fu->occupied--;
+		fu->chosen--;
+	}
+	sim->num_chosen = 0;
 	return;
 }
 
 /*
- * This helper function actually updates the smith counter
+ * Look through what was just moved to state update and resolve them in tag
+ * order. Without a ROB that trains the predictor and lets dispatch go again.
+ * With one, a mispredicted branch squashes everything after it instead.
+ * Returns how many squashes there were, since the driver has to forget its
+ * fetch queue and what it marked in the dispatch queue when there are any,
+ * or -1 if the replay queue couldn't grow
  */
-void updateSmithCounter(uint64_t row, uint64_t col, int taken) {
-	uint64_t counterValue = GSelect[row][col];
-	switch(counterValue) {
-		case 0:
-			if(taken == 1) {
-				GSelect[row][col] = 1;
+int resolveBranches(proc_sim *sim, int64_t clock, if_listnode **fetch_head) {
+	int numSquashes = 0;
+	int numUnresolved = findNumUnresolved(sim);
+	while(numUnresolved > 0) {
+		int64_t cycle = getMinDoneCycle(sim);
+		int index = getMinTagIndex(sim, cycle);
+		instr *branch = sim->sup[index];
+
+		// mark as resolved
+		branch->resolved = 1;
+
+		if(sim->curr_Config.rob_size > 0) {
+			if(branch->correct_pred == 0) {
+				// This can take younger branches out of state update too
+				if(squashYounger(sim, branch, fetch_head) != 0)
+					return -1;
+				sim->fetch_resume = clock + sim->curr_Config.mispredict_penalty;
+				numSquashes++;
+				numUnresolved = findNumUnresolved(sim);
 			} else {
-				GSelect[row][col] = 0;
+				numUnresolved--;
 			}
-			break;
-		case 1:
-			if(taken == 1) {
-				GSelect[row][col] = 2;
-			} else {
-				GSelect[row][col] = 0;
+			continue;
+		}
+
+		// Train the predictor, which also updates the GHR
+		predictorUpdate(&sim->predictor, branch->address, branch->taken);
+
+		if(branch->correct_pred == 0) {
+			assert(sim->stallDispatch == 1); // Has to be true
+			// But now we resolved so we can set stall dispatch to 0
+			sim->stallDispatch = 0;
+		}
+
+		// decrement
+		numUnresolved--;
+	}
+	return numSquashes;
+}
+
+/*
+ * Throw away everything younger than a mispredicted branch. Everything that
+ * was dispatched is in the ROB in order, so that's the list of what to squash.
+ * It all gets pulled out of the FUs, the scheduling queue, state update and
+ * the dispatch queue, and then goes in front of the replay queue along with
+ * the fetch queue so it gets fetched again in the same order. Returns -1 if
+ * the replay queue couldn't grow to hold it all
+ */
+int squashYounger(proc_sim *sim, instr *branch, if_listnode **fetch_head) {
+	int64_t tag = branch->dest_tag;
+	instr_ring *rob = &sim->rob;
+
+	// State update
+	for(int i = 0; i < sim->curr_Config.num_r_bus; i++) {
+		if(sim->sup[i] != NULL && sim->sup[i]->dest_tag > tag)
+			sim->sup[i] = NULL;
+	}
+
+	// FUs. Nothing is chosen this early in the cycle, so the heap just gets
+	// rebuilt from whatever is left
+	assert(sim->num_chosen == 0);
+	for(int c = 0; c < SCHED_FU_CLASSES; c++) {
+		func_unit *fu = &sim->k[c];
+		for(int i = 0; i < fu->num_slots; i++) {
+			execute_node *node = &fu->slots[i];
+			if(node->theInstr != NULL && node->theInstr->dest_tag > tag) {
+				assert(node->chosen == 0);
+				node->theInstr = NULL;
+				fu->free_slots[fu->num_free++] = node->slot;
+				fu->occupied--;
 			}
-			break;
-		case 2:
-			if(taken == 1) {
-				GSelect[row][col] = 3;
-			} else {
-				GSelect[row][col] = 1;
+		}
+	}
+	int numLeft = sim->exec_heap_size;
+	sim->exec_heap_size = 0;
+	for(int i = 0; i < numLeft; i++) {
+		execute_node *node = sim->exec_heap[i];
+		if(node->theInstr != NULL)
+			execHeapPush(sim, node);
+	}
+
+	// Scheduling queues. The survivors lose any consumers that are going away
+	for(int i = 0; i < sim->num_sched_queues; i++) {
+		schedule_queue *q = &sim->sched_q[i];
+		for(int slot = 0; slot < q->tail; slot++) {
+			if(!bitTest(q->valid, slot))
+				continue;
+			instr *theInstr = q->entries[slot];
+			if(theInstr->dest_tag > tag) {
+				schedDrop(sim, q, slot);
+				continue;
 			}
-			break;
-		case 3:
-			if(taken == 1) {
-				GSelect[row][col] = 3;
-			} else {
-				GSelect[row][col]  = 2;
+			wakeup_node **link = &sim->inflight.consumers[theInstr->id];
+			while(*link != NULL) {
+				wakeup_node *node = *link;
+				if(sim->inflight.record[node->consumer]->dest_tag > tag) {
+					*link = node->next;
+					poolFree(&sim->wakeup_pool, node);
+				} else {
+					link = &node->next;
+				}
 			}
-			break;
-		default:
-			break;
+		}
+		while(q->tail > 0 && !bitTest(q->valid, q->tail - 1))
+			q->tail--;
 	}
-	return;
+
+	// Everything in the dispatch queue is younger than anything that's made
+	// it to state update
+	sim->dispatch_q.head = 0;
+	sim->dispatch_q.count = 0;
+	sim->dispatch_q.num_marked = 0;
+
+	// Now build the new replay queue in the spare ring: the ROB after the 
+	// branch, then the fetch queue, then whatever was still waiting to be 
+	// replayed from before. The two rings just swap, so they only ever get 
+	// allocated again when a squash is bigger than any before it
+	instr_ring *newReplay = &sim->replay_spare;
+	newReplay->head = 0;
+	newReplay->count = 0;
+	int failed = 0;
+
+	int keep = 0;
+	while(keep < rob->count && dispatchAt(rob, keep)->dest_tag <= tag)
+		keep++;
+	for(int i = keep; i < rob->count; i++) {
+		instr *theInstr = dispatchAt(rob, i);
+		wakeup_node *node = sim->inflight.consumers[theInstr->id];
+		while(node != NULL) {
+			wakeup_node *temp = node;
+			node = node->next;
+			poolFree(&sim->wakeup_pool, temp);
+		}
+		resetForReplay(sim, theInstr);
+		failed |= ringPush(newReplay, theInstr);
+	}
+	rob->count = keep;
+
+	while(fetch_head[0] != NULL) {
+		if_listnode *temp = fetch_head[0];
+		resetForReplay(sim, temp->theInstr);
+		failed |= ringPush(newReplay, temp->theInstr);
+		fetch_head[0] = temp->next;
+		poolFree(&sim->fetch_pool, temp);
+	}
+
+	for(int i = 0; i < sim->replay.count; i++)
+		failed |= ringPush(newReplay, dispatchAt(&sim->replay, i));
+	if(failed)
+		return -1;
+	instr_ring oldReplay = sim->replay;
+	sim->replay = *newReplay;
+	*newReplay = oldReplay;
+
+	rebuildRegFile(sim);
+	
+	// A line fetch missed on is still on its way in, so fetch_miss_line stays 
+	// and fetchInstr makes anything on it wait for the fill
+	return 0;
 }
 
 /*
- * This helper function updates the GHR
+ * Helper function that puts a squashed instruction back the way it was when it
+ * was first read from the trace
  */
-void updateGHR(int taken) {
-	if(taken == 1) {
-		shiftTaken();
-		return;
-	} 
-	if(taken == 0) {
-		shiftNotTaken();
-		return;
+void resetForReplay(proc_sim *sim, instr *theInstr) {
+	inflightReset(&sim->inflight, theInstr->id);
+	theInstr->correct_pred = -1;
+	theInstr->resolved = (theInstr->branch == 1) ? 0 : -1;
+	theInstr->fetch = 0;
+	theInstr->disp = 0;
+	theInstr->sched = 0;
+	theInstr->exec = 0;
+	theInstr->state = 0;
+}
+
+/*
+ * Helper function that makes every register ready again. The bits past the 
+ * last register get set too, but nothing ever looks at them
+ */
+void resetRegStatus(reg_status_table *rf) {
+	int words = (rf->num_regs + 63) / 64;
+	for(int w = 0; w < words; w++)
+		rf->ready[w] = ~0ULL;
+	for(int i = 0; i < rf->num_regs; i++) {
+		rf->tag[i] = -5; // Tag. -5 is just going to be our default
+		rf->producer[i] = NULL;
 	}
 }
 
 /*
- * This helper function shifts in a 1 in case the branch was taken
+ * After a squash the register file might name squashed producers. Everything
+ * that survived and hasn't written its result yet is still in a scheduling
+ * queue, so just replay their renames onto an all ready file. With more than
+ * one queue they aren't in age order overall, so the youngest tag wins
  */
-void shiftTaken() {
-	GHR = ((GHR << 1) | 1);
+void rebuildRegFile(proc_sim *sim) {
+	reg_status_table *rf = &sim->reg_status;
+	resetRegStatus(rf);
+	for(int i = 0; i < sim->num_sched_queues; i++) {
+		schedule_queue *q = &sim->sched_q[i];
+		for(int slot = 0; slot < q->tail; slot++) {
+			if(!bitTest(q->valid, slot))
+				continue;
+			instr *theInstr = q->entries[slot];
+			int destReg = theInstr->destReg;
+			if(destReg == -1)
+				continue;
+			if(!bitTest(rf->ready, destReg) && rf->tag[destReg] > theInstr->dest_tag)
+				continue;
+			regRename(rf, destReg, theInstr);
+		}
+	}
 	return;
 }
 
 /*
- * This helper function shifts in a 0 in case the branch was not taken
+ * Look through the state update array and find the number of branches in it
+ * that are unresolved
  */
-void shiftNotTaken() {
-	GHR = (GHR << 1);
-	return;
+int findNumUnresolved(proc_sim *sim) {
+	int i;
+	int numUnresolved = 0;
+	for(i = 0; i < sim->curr_Config.num_r_bus; i++) {
+		if(sim->sup[i] == NULL)
+			continue;
+		if(sim->sup[i]->resolved == 0) {
+			assert(sim->sup[i]->branch == 1); // had to be a branch
+			numUnresolved++;
+		}
+	}
+	return numUnresolved;
+}
+
+/*
+ * Helper function to get the cycle an instruction finished executing. With 
+ * every FU taking 1 cycle this is just the cycle it entered exec
+ */
+int64_t doneCycle(proc_sim *sim, instr *theInstr) {
+	int fuClass = schedClassOf(theInstr->funcUnit);
+	return theInstr->exec + sim->k[fuClass].latency - 1;
+}
+
+/*
+ * Get the min cycle the instructions finished exec. This relative ordering is the
+ * same as the order in which they left exec
+ */
+int64_t getMinDoneCycle(proc_sim *sim) {
+	int i;
+	int64_t minCycle = INT64_MAX;
+	for(i = 0; i < sim->curr_Config.num_r_bus; i++) {
+		if(sim->sup[i] == NULL)
+			continue;
+		if((sim->sup[i]->resolved == 0) && (doneCycle(sim, sim->sup[i]) < minCycle)) {
+			minCycle = doneCycle(sim, sim->sup[i]);
+		}
+	}
+	return minCycle;
+}
+
+/*
+ * Look through state update array and get the index of the branch instruction
+ * that is unresolved with the lowest tag
+ */
+int getMinTagIndex(proc_sim *sim, int64_t cycle) {
+	int i;
+	int64_t minTag = INT64_MAX;
+	int minIndex = -1;
+	for(i = 0; i < sim->curr_Config.num_r_bus; i++) {
+		if(sim->sup[i] == NULL)
+			continue;
+		if((sim->sup[i]->resolved == 0) && (sim->sup[i]->dest_tag < minTag) && (doneCycle(sim, sim->sup[i]) == cycle)) {
+			minIndex = i;
+			minTag = sim->sup[i]->dest_tag;
+		}
+	}
+	return minIndex;
 }
 
 /* 
@@ -446,14 +1084,19 @@ void shiftNotTaken() {
  * on future calls to this function, we don't try to move over instructions that 
  * are already in a FU 
  */
-void moveToExecute(int clock) {
-	schedule_node *iterator = schedule_head;
-	while(iterator != NULL) {
-		if(iterator->sendToExecute == 1 && iterator->waiting == 0) {
-			putInFU(iterator->theInstr, iterator->theInstr->funcUnit, clock);
-			iterator->waiting = 1;
+void moveToExecute(proc_sim *sim, int64_t clock) {
+	for(int i = 0; i < sim->num_sched_queues; i++) {
+		schedule_queue *q = &sim->sched_q[i];
+		int words = schedWordsUsed(q);
+		for(int w = 0; w < words; w++) {
+			uint64_t bits = q->sendToExecute[w] & ~q->waiting[w];
+			while(bits != 0) {
+				int slot = (w << 6) + __builtin_ctzll(bits);
+				bits &= bits - 1;
+				putInFU(sim, q->entries[slot], q->entries[slot]->funcUnit, clock);
+				bitSet(q->waiting, slot);
+			}
 		}
-		iterator = iterator->next;
 	}
 	return;
 }
@@ -461,45 +1104,23 @@ void moveToExecute(int clock) {
 /*
  * Helper function that puts an instruction in an FU
  */
-void putInFU(instr *theInstr, int FU_num, int clock) {
-	execute_node **FU;
-	int numSpots;
-	execute_node *newNode = (execute_node *)malloc(sizeof(execute_node) * 1);
+void putInFU(proc_sim *sim, instr *theInstr, int FU_num, int64_t clock) {
+	int fuClass = schedClassOf(FU_num);
+	assert(fuClass >= 0);
+	func_unit *fu = &sim->k[fuClass];
+	
+	// Just ensure that there actually is a spot if we thought there was an open one.
+	assert(fu->num_free > 0);
+	execute_node *newNode = &fu->slots[fu->free_slots[--fu->num_free]];
+	fu->occupied++;
+	
 	theInstr->exec = clock;
 	newNode->theInstr = theInstr;
 	newNode->chosen = 0;
+	newNode->done_cycle = clock + fu->latency - 1;
 	
-	switch(FU_num) {
-		case 0:
-			FU = k_0;
-			numSpots = curr_Config->k0_size;
-			break;
-		case 1:
-			FU = k_1;
-			numSpots = curr_Config->k1_size;
-			break;
-		case -1:
-			FU = k_1;
-			numSpots = curr_Config->k1_size;
-			break;
-		case 2:
-			FU = k_2;
-			numSpots = curr_Config->k2_size;
-			break;
-		default:
-			break;
-	}
-	
-	int i;
-	for(i = 0; i < numSpots; i++) {
-		if(FU[i] == NULL) {
-			FU[i] = newNode;
-			break; // once you find an open spot, you're done
-		}
-	}
-	
-	// Just ensure that you actually found a spot if we thought there was an open one.
-	assert(FU[i] == newNode); 
+	// Then it can compete for a result bus
+	execHeapPush(sim, newNode);
 	return;
 }
 
@@ -508,166 +1129,197 @@ void putInFU(instr *theInstr, int FU_num, int clock) {
  * the dispatch queue to the schedule queue. This should happen at the very start
  * of the cycle to simulate that they just moved immediately
  */ 
-void dispatchToSchedule(int clock, int totalMarked) {
-	dispatch_node *disp_iterator = dispatch_head;
-	schedule_node *schedule_iterator = schedule_head;
-	int count = 0;
+void dispatchToSchedule(proc_sim *sim, int64_t clock, int totalMarked) {
+	dispatch_queue *q = &sim->dispatch_q;
 	
-	while(disp_iterator != NULL) {
-		if(count == totalMarked)
-			break; // No need to keep searching if we already found all the marked ones
-		if(disp_iterator->mark_for_move == 1) {
-			count++;
-			instr *theInstr = disp_iterator->theInstr;
-			schedule_node *newNode = (schedule_node *)malloc(sizeof(schedule_node)*1);
-			newNode->theInstr = theInstr;
-			newNode->theInstr->sched = clock;
-			newNode->prev = NULL;
-			newNode->next = NULL;
-			newNode->fired = 0;
-			newNode->sendToExecute = 0;
-			newNode->waiting = 0;
-			
-			// Then just add this new node to the schedule queue
-			if(schedule_iterator == NULL) {
-				schedule_head = newNode;
-				schedule_iterator = schedule_head;
-				schedule_size++;
-			} else {
-				while(schedule_iterator->next != NULL)
-					schedule_iterator = schedule_iterator->next;
-				schedule_iterator->next = newNode;
-				newNode->prev = schedule_iterator;
-				schedule_size++;
-				assert(schedule_size <= curr_Config->max_sched_queue);
-			}
-		}
-		dispatch_node *temp = disp_iterator;
-		disp_iterator = disp_iterator->next;
-		free(temp); // Just free the old head of the dispatch queue
+	// The marked instructions are always the oldest ones in the queue
+	assert(totalMarked == q->num_marked);
+	for(int i = 0; i < totalMarked; i++) {
+		instr *theInstr = dispatchAt(q, i);
+		theInstr->sched = clock;
+		
+		// Then just add it to the end of its schedule queue
+		schedule_queue *sq = schedQueueFor(sim, schedClassOf(theInstr->funcUnit));
+		schedInsert(sim, sq, theInstr);
+		assert(sq->count <= sq->limit);
 	}
-	dispatch_head = disp_iterator; // Make the head whatever the new iterator is
+	
+	// Then just pop them off the front of the dispatch queue
+	q->head = (q->head + totalMarked) & (q->capacity - 1);
+	q->count -= totalMarked;
+	q->num_marked = 0;
 	return;
 }
 
 /* 
  * This function enqueues all instructions from the fetch queue into the dispatch 
- * queue
+ * queue. It stops early if the dispatch queue is at its limit, and returns how 
+ * many instructions it moved
  */
-void dispatch_Enqueue(if_listnode **fetch_head, int cycle) {
-	dispatch_node *dispatch_iterator = dispatch_head;
-	int numAllowed = curr_Config->fetch_rate;
+int dispatch_Enqueue(proc_sim *sim, if_listnode **fetch_head, int64_t cycle) {
+	dispatch_queue *q = &sim->dispatch_q;
+	int numAllowed = sim->curr_Config.fetch_rate;
+	int numMoved = 0;
 	
-	while(fetch_head[0] != NULL && (stallDispatch == 0) && (numAllowed > 0)) { 
-		// Get items from fetch queue and put the instruction in a dispatch node
+	instr_ring *rob = &sim->rob;
+	int useROB = (sim->curr_Config.rob_size > 0);
+
+	while(fetch_head[0] != NULL && (sim->stallDispatch == 0) && (numAllowed > 0) && 
+		(q->limit == 0 || q->count < q->limit) && (!useROB || rob->count < rob->limit)) { 
+		// Get items from fetch queue and put the instruction at the end of the 
+		// dispatch queue
 		if_listnode *temp = fetch_head[0];
 		
-		dispatch_node *newDispatchNode = (dispatch_node *)malloc(sizeof(dispatch_node)*1);
-		if(newDispatchNode == NULL)
-			return;
-		newDispatchNode->theInstr = temp->theInstr;
-		newDispatchNode->theInstr->disp = cycle; // Set the cycle for each instruction
-		newDispatchNode->next = NULL;
-		newDispatchNode->mark_for_move = 0; 
+		if(q->count == q->capacity && growDispatchQueue(q) != 0)
+			return numMoved;
+		instr *theInstr = temp->theInstr;
+		theInstr->disp = cycle; // Set the cycle for each instruction
 		
 		// Now if it's a branch we need to get the prediction and see if it's 
-		// correct or not
-		if(newDispatchNode->theInstr->branch == 1) {
-			(myStats->totalBranchInstr)++;
-			int prediction = getPrediction(newDispatchNode->theInstr->address);
-			if(prediction == newDispatchNode->theInstr->taken) {
-				(myStats->totalCorrectBranch)++;
-				newDispatchNode->theInstr->correct_pred = 1;
+		// correct or not. With a ROB the stats wait until it commits
+		if(theInstr->branch == 1) {
+			if(!useROB)
+				(sim->myStats.totalBranchInstr)++;
+			int prediction = getPrediction(sim, theInstr->address);
+			if(prediction == theInstr->taken) {
+				if(!useROB)
+					(sim->myStats.totalCorrectBranch)++;
+				theInstr->correct_pred = 1;
 			} else {
-				newDispatchNode->theInstr->correct_pred = 0;
+				theInstr->correct_pred = 0;
 			}
 		}
-		
-		// Just handle the fact that it's a branch
-		if(newDispatchNode->theInstr->correct_pred == 0) {
-			assert(newDispatchNode->theInstr->branch == 1); // has to be a branch
-			stallDispatch = 1; // won't move any more until this flag is turned off
+
+		// Just handle the fact that it's a branch. With a ROB we keep going and
+		// squash when it resolves instead
+		if(useROB) {
+			ringPush(rob, theInstr);
+		} else if(theInstr->correct_pred == 0) {
+			assert(theInstr->branch == 1); // has to be a branch
+			sim->stallDispatch = 1; // won't move any more until this flag is turned off
 		}
 		
-		if(dispatch_iterator == NULL) {
-			// If dispatch_queue is empty, the new node is the queue
-			dispatch_head = newDispatchNode;
-			dispatch_iterator = dispatch_head;
-		} else {
-			// otherwise iterator through the dispatch queue and add the new node 
-			// to the end
-			while(dispatch_iterator->next != NULL)
-				dispatch_iterator = dispatch_iterator->next;
-			dispatch_iterator->next = newDispatchNode;
-		}
+		q->entries[(q->head + q->count) & (q->capacity - 1)] = theInstr;
+		q->count++;
+		
 		// Move the fetch queue pointer to the next instruction in the list
 		fetch_head[0] = (fetch_head[0]->next);
 		// Then free the old head
-		free(temp);
+		poolFree(&sim->fetch_pool, temp);
 		
 		numAllowed--;
+		numMoved++;
 	}
 	
-	return;
+	return numMoved;
 }
 
 /*
- * Look at GSelect entry to get the prediction
+ * Gives the driver the next squashed instruction to fetch again, or NULL if
+ * there aren't any and it should read the trace
  */
-int getPrediction(uint64_t address) {
-	uint64_t row = (address/4)%128;
-	uint64_t col = getGHR();
-	uint64_t smithValue = GSelect[row][col];
-	int prediction;
-	
-	switch(smithValue) {
-		case 0:
-			prediction = 0;
-			break;
-		case 1:
-			prediction = 0;
-			break;
-		case 2:
-			prediction = 1;
-			break;
-		case 3:
-			prediction = 1;
-			break;
-		default:
-			assert(0);
-			break;
+instr *replayNext(proc_sim *sim) {
+	instr_ring *q = &sim->replay;
+	if(q->count == 0)
+		return NULL;
+	instr *theInstr = dispatchAt(q, 0);
+	q->head = (q->head + 1) & (q->capacity - 1);
+	q->count--;
+	return theInstr;
+}
+
+/*
+ * The fetch stage's side of the I-cache and the fetch block. Fetch reads one 
+ * line a cycle, so the first instruction of the cycle looks its line up and 
+ * anything after it has to be in the same line or wait for the next cycle. A 
+ * miss holds the instruction until the line comes back. There's only one 
+ * miss out at a time, and a squash doesn't cancel it, so the line isn't 
+ * there early just because the tags already have it. With 
+ * fetch_break_taken a branch the predictor thinks is taken also ends the 
+ * block, since whatever comes next would be fetched from somewhere else
+ */
+fetch_result fetchInstr(proc_sim *sim, instr *theInstr, int64_t clock, int numFetched) {
+	if(sim->curr_Config.icache.size_kb > 0) {
+		uint64_t line = icacheLine(&sim->icache, theInstr->address) + 1;
+		if(numFetched > 0) {
+			if(line != sim->fetch_line)
+				return FETCH_HOLD;
+		} else if(line == sim->fetch_miss_line) {
+			if(clock < sim->fetch_miss_ready) {
+				// Still coming in (a squash sent fetch back here early)
+				if(sim->fetch_miss_ready > sim->fetch_resume)
+					sim->fetch_resume = sim->fetch_miss_ready;
+				return FETCH_HOLD;
+			}
+			// The line we missed on is here now. That was already counted
+			sim->fetch_miss_line = 0;
+			sim->fetch_line = line;
+		} else {
+			sim->fetch_line = line;
+			if(icacheAccess(&sim->icache, theInstr->address) == 0) {
+				// Hits can go on under a miss, but another miss has to wait 
+				// for the one that's already out
+				int64_t start = (clock > sim->fetch_miss_ready) ? clock : sim->fetch_miss_ready;
+				sim->fetch_miss_line = line;
+				sim->fetch_miss_ready = start + sim->icache.settings.miss_latency;
+				if(sim->fetch_miss_ready > sim->fetch_resume)
+					sim->fetch_resume = sim->fetch_miss_ready;
+				return FETCH_HOLD;
+			}
+		}
 	}
-	return prediction;
+	
+	if(sim->curr_Config.fetch_break_taken && theInstr->branch == 1 && 
+		predictorPredict(&sim->predictor, theInstr->address) == 1)
+		return FETCH_LAST;
+	return FETCH_OK;
 }
 
-/* 
- * This function just gets the GHR
+/*
+ * Helper function that gives an instruction fetch couldn't take back, so it's 
+ * the first thing fetched next time. Returns -1 if the replay queue couldn't 
+ * grow to hold it
+ */
+int fetchHold(proc_sim *sim, instr *theInstr) {
+	instr_ring *q = &sim->replay;
+	if(q->count == q->capacity && growDispatchQueue(q) != 0)
+		return -1;
+	q->head = (q->head - 1) & (q->capacity - 1);
+	q->entries[q->head] = theInstr;
+	q->count++;
+	return 0;
+}
+
+/*
+ * Ask the branch predictor what it thinks this branch will do
  */
-uint64_t getGHR() {
-	return GHR & 0x7;
+int getPrediction(proc_sim *sim, uint64_t address) {
+	return predictorPredict(&sim->predictor, address);
 }
 
 /*
  * This function writes whatever is in state update to the register file (if 
  * the destination tags match)
  */
-void writeToRegFile() {
-	int numSUElements = curr_Config->num_r_bus;
+void writeToRegFile(proc_sim *sim) {
+	reg_status_table *rf = &sim->reg_status;
+	int numSUElements = sim->curr_Config.num_r_bus;
 	for(int i = 0; i < numSUElements; i++) {
 		
-		if(sup[i] == NULL)
+		if(sim->sup[i] == NULL)
 			continue;
 		
-		int destReg = sup[i]->destReg;
-		int destTag = sup[i]->dest_tag;
+		int destReg = sim->sup[i]->destReg;
+		int64_t destTag = sim->sup[i]->dest_tag;
 		
 		if(destReg == -1)
 			continue; // If it's -1, there's nothing to update. Just move on
 		
-		if(reg_File[destReg][1] == destTag) {
-			assert(reg_File[destReg][0] == 0); // Should not be currently ready
-			reg_File[destReg][0] = 1; // Set to ready
-			reg_File[destReg][1] = -5; // set back to default
+		if(rf->tag[destReg] == destTag) {
+			assert(!bitTest(rf->ready, destReg)); // Should not be currently ready
+			bitSet(rf->ready, destReg); // Set to ready
+			rf->tag[destReg] = -5; // set back to default
+			rf->producer[destReg] = NULL;
 		}
 	}
 	return;
@@ -675,16 +1327,18 @@ void writeToRegFile() {
 
 /* 
  * This function goes through the schedule queue and marks instructions to fire 
- * if both the source registers are ready
- */
-void setToFired() {
-	schedule_node *schedule_iterator = schedule_head;
-	while(schedule_iterator != NULL) {
-		if(schedule_iterator->theInstr->source1_ready && schedule_iterator->theInstr->source2_ready &&
-			schedule_iterator->fired != 1) {
-			schedule_iterator->fired = 1;
+ * if both the source registers are ready. Entries only become ready here if 
+ * they were already ready when they came in (the broadcast fires the rest), 
+ * so that's the only bitmap we have to look at
+ */
+void setToFired(proc_sim *sim) {
+	for(int i = 0; i < sim->num_sched_queues; i++) {
+		schedule_queue *q = &sim->sched_q[i];
+		int words = schedWordsUsed(q);
+		for(int w = 0; w < words; w++) {
+			q->fired[w] |= q->newly_ready[w];
+			q->newly_ready[w] = 0;
 		}
-		schedule_iterator = schedule_iterator->next;
 	}
 	return;
 }
@@ -695,130 +1349,217 @@ void setToFired() {
  * scheduling queue at the very start of the next cycle. The nodes that get 
  * marked also get info updated from reading of register file 
  */
-int reserveScheduleSpots() {
-	// Num available spots is number of free spots
-	int numAvailSpots = curr_Config->max_sched_queue - schedule_size;
-	
-	dispatch_node *iterator = dispatch_head;
-	int count = 0; // This is the number of nodes we actually mark
-	while((iterator != NULL) && (numAvailSpots > 0)) {
-		assert(iterator->mark_for_move == 0); // if it was already 1, it shouldn't be here
-		iterator->mark_for_move = 1;
-		iterator = iterator->next;
-		numAvailSpots--;
-		count++;
+int reserveScheduleSpots(proc_sim *sim) {
+	dispatch_queue *q = &sim->dispatch_q;
+	assert(q->num_marked == 0); // Everything marked last cycle should have moved already
+
+	if(sim->num_sched_queues == 1) {
+		// Num available spots is number of free spots
+		int numAvailSpots = sim->sched_q[0].limit - sim->sched_q[0].count;
+
+		// Just mark as many of the oldest instructions as will fit
+		q->num_marked = (q->count < numAvailSpots) ? q->count : numAvailSpots;
+		if(q->num_marked < 0)
+			q->num_marked = 0;
+		return q->num_marked;
 	}
-	return count;
+
+	// With a reservation station per class, dispatch still goes in order. So
+	// mark from the oldest until one doesn't have room in its station
+	int numAvailSpots[SCHED_FU_CLASSES];
+	for(int c = 0; c < SCHED_FU_CLASSES; c++)
+		numAvailSpots[c] = sim->sched_q[c].limit - sim->sched_q[c].count;
+	while(q->num_marked < q->count) {
+		int fuClass = schedClassOf(dispatchAt(q, q->num_marked)->funcUnit);
+		assert(fuClass >= 0);
+		if(numAvailSpots[fuClass] <= 0)
+			break;
+		numAvailSpots[fuClass]--;
+		q->num_marked++;
+	}
+	return q->num_marked;
 }
 
 /*
  * This function reads/updates the register file for the n marked slots in the 
- * dispatch queue that will be moved to the scheduling queue at the very start of the next cycle
+ * dispatch queue that will be moved to the scheduling queue at the very start of the next cycle.
+ * Returns -1 if there was no memory left for a wakeup list node
  */
-void readUpdateRegFile(int totalMarked) {
-	dispatch_node *iterator = dispatch_head;
-	int count = 0; // We can stop searching after we have found n instructions that were marked
-	while(iterator != NULL) {
-		if(count == totalMarked)
-			break;
-		if(iterator->mark_for_move == 1) {
-			count++;
-			int src_1_reg = iterator->theInstr->source1;
-			int src_2_reg = iterator->theInstr->source2;
-			int dest_reg = iterator->theInstr->destReg;
+int readUpdateRegFile(proc_sim *sim, int totalMarked) {
+	dispatch_queue *q = &sim->dispatch_q;
+	inflight_table *t = &sim->inflight;
+	reg_status_table *rf = &sim->reg_status;
+	for(int i = 0; i < totalMarked; i++) {
+		instr *theInstr = dispatchAt(q, i);
+		int id = theInstr->id;
+		int src_1_reg = theInstr->source1;
+		int src_2_reg = theInstr->source2;
+		int dest_reg = theInstr->destReg;
+		
+		// Fill the data for src 1 in the in-flight table
+		if(src_1_reg == -1) {
+			// In this case there is no register needed
+			t->src_tag[2*id] = -5; // Placeholder
+		}
+		else if(bitTest(rf->ready, src_1_reg)) {
+			// If the register file entry is ready, then
+			// we can just take that value
+			assert(rf->tag[src_1_reg] == -5);
+			t->src_tag[2*id] = -5;
+		} else {
+			// If the register file entry is not ready, then 
+			// we take the tag from the register file
+			assert(rf->tag[src_1_reg] > -1);
+			t->src_tag[2*id] = rf->tag[src_1_reg];
+			if(!sim->curr_Config.wakeup_match && 
+				addConsumer(sim, rf->producer[src_1_reg], theInstr, 1) != 0)
+				return -1;
+		}
+		
+		// Fill the data for src2 in the in-flight table
+		if(src_2_reg == -1) {
+			// In this case there is no register needed
+			t->src_tag[2*id + 1] = -5; // Placeholder
+		}
+		else if(bitTest(rf->ready, src_2_reg)) {
+			// If the register file entry is ready, then
+			// we can just take that value
+			assert(rf->tag[src_2_reg] == -5);
+			t->src_tag[2*id + 1] = -5;
+		} else {
+			// If the register file entry is not ready, then 
+			// we take the tag from the register file
+			assert(rf->tag[src_2_reg] > -1);
+			t->src_tag[2*id + 1] = rf->tag[src_2_reg];
+			if(!sim->curr_Config.wakeup_match && 
+				addConsumer(sim, rf->producer[src_2_reg], theInstr, 2) != 0)
+				return -1;
+		}
+		
+		// Now update the register file for the dest reg
+		if(dest_reg == -1) {
+		}
+		else {
+			regRename(rf, dest_reg, theInstr);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Helper function that puts a consumer on its producer's wakeup list. The 
+ * consumer will be in the scheduling queue by the time the producer gets to 
+ * state update, so the broadcast can find it through this list. Returns -1 if 
+ * the node couldn't be allocated
+ */
+int addConsumer(proc_sim *sim, instr *producer, instr *consumer, int source) {
+	inflight_table *t = &sim->inflight;
+	assert(producer != NULL);
+	assert(producer->dest_tag == t->src_tag[2*consumer->id + source - 1]);
+	wakeup_node *node = (wakeup_node *)poolAlloc(&sim->wakeup_pool);
+	if(node == NULL)
+		return -1;
+	node->consumer = consumer->id;
+	node->source = source;
+	node->next = t->consumers[producer->id];
+	t->consumers[producer->id] = node;
+	return 0;
+}
+
+/*
+ * This function just updates the scheduling queue via the result bus. The 
+ * sources waiting on something in state update get marked ready with the tag 
+ * set back to the default -5, and any entry that has both sources ready is 
+ * fired. Normally only the consumers on each producer's list are touched, the 
+ * tag match wakeup compares every entry instead
+ */ 
+void broadcastToSched(proc_sim *sim) {
+	if(sim->curr_Config.wakeup_match)
+		broadcastMatchTags(sim);
+	else
+		broadcastToConsumers(sim);
+}
+
+/*
+ * Each element in state update only has to wake up the consumers on its own 
+ * list, which are found through the in-flight table
+ */
+void broadcastToConsumers(proc_sim *sim) {
+	int numSUElements = sim->curr_Config.num_r_bus;
+	inflight_table *t = &sim->inflight;
+
+	for(int i = 0; i < numSUElements; i++) {
+		if(sim->sup[i]==NULL)
+			continue;
+		wakeup_node *node = t->consumers[sim->sup[i]->id];
+		while(node != NULL) {
+			int id = node->consumer;
+			int src = node->source - 1;
+			int slot = t->sched_slot[id];
+			schedule_queue *q = schedQueueFor(sim, t->fu_class[id]);
+			int w = slot >> 6;
+			uint64_t bit = 1ULL << (slot & 63);
+			assert(slot >= 0 && (q->fired[w] & bit) == 0);
+			assert((q->src_ready[src][w] & bit) == 0 && q->wait_tag[src][slot] == sim->sup[i]->dest_tag);
 			
-			// Fill the data for src 1 in the instruction struct
-			if(src_1_reg == -1) {
-				// In this case there is no register needed
-				iterator->theInstr->source1_tag = -5; // Placeholder
-				iterator->theInstr->source1_ready = 1;
-			}
-			else if(reg_File[src_1_reg][0] == 1) {
-				// If the register file entry is ready, then
-				// we can just take that value
-				assert(reg_File[src_1_reg][1] == -5);
-				iterator->theInstr->source1_tag = -5;
-				iterator->theInstr->source1_ready = 1;
-			} else {
-				// If the register file entry is not ready, then 
-				// we take the tag from the register file
-				assert(reg_File[src_1_reg][0] != 1);
-				assert(reg_File[src_1_reg][1] > -1);
-				iterator->theInstr->source1_tag = reg_File[src_1_reg][1];
-				iterator->theInstr->source1_ready = 0;
-			}
+			q->src_ready[src][w] |= bit; // Set to ready
+			q->wait_tag[src][slot] = -5; // set to default
 			
-			// Fill the data for src2 in the instruction struct
-			if(src_2_reg == -1) {
-				// In this case there is no register needed
-				iterator->theInstr->source2_tag = -5; // Placeholder
-				iterator->theInstr->source2_ready = 1;
-			}
-			else if(reg_File[src_2_reg][0] == 1) {
-				// If the register file entry is ready, then
-				// we can just take that value
-				assert(reg_File[src_2_reg][1] == -5);
-				iterator->theInstr->source2_tag = -5;
-				iterator->theInstr->source2_ready = 1;
-			} else {
-				// If the register file entry is not ready, then 
-				// we take the tag from the register file
-				assert(reg_File[src_2_reg][0] != 1);
-				assert(reg_File[src_2_reg][1] > -1);
-				iterator->theInstr->source2_tag = reg_File[src_2_reg][1];
-				iterator->theInstr->source2_ready = 0;
+			// Now, just check if both source 1 and 2 are ready for the instruction.
+			// If so, then just mark the instruction as 'fired'
+			if(q->src_ready[1 - src][w] & bit) {
+				q->fired[w] |= bit; // This instruction is eligible to move to exec next cycle
 			}
 			
-			// Now update the register file for the dest reg
-			if(dest_reg == -1) {
-			}
-			else {
-				reg_File[dest_reg][0] = 0;
-				reg_File[dest_reg][1] = iterator->theInstr->dest_tag;
-			}
+			wakeup_node *temp = node;
+			node = node->next;
+			poolFree(&sim->wakeup_pool, temp);
 		}
-		iterator = iterator->next;
+		t->consumers[sim->sup[i]->id] = NULL;
 	}
 	return;
 }
 
 /*
- * This function just updates the scheduling queue via the result bus. So for 
- * each element in state update, you just run through the whole scheduling queue
- * and look for not fired nodes that have non-ready src1's and src2's that have 
- * matching register numbers and tags. Just mark them to ready and set the tag 
- * to the default -5
- */ 
-void broadcastToSched() {
-	int numSUElements = curr_Config->num_r_bus;
-	schedule_node *iterator;
-	
-	for(int i = 0; i < numSUElements; i++) {
-		if(sup[i]==NULL)
-			continue;
-		iterator = schedule_head;
-		while(iterator != NULL) {
-			if(iterator->fired ==0) {
-				if(iterator->theInstr->source1 == sup[i]->destReg && iterator->theInstr->source1_ready == 0 &&
-					iterator->theInstr->source1_tag == sup[i]->dest_tag) {
-						iterator->theInstr->source1_ready = 1; // Set to ready
-						iterator->theInstr->source1_tag = -5; // set to default
-					}
-
-				if(iterator->theInstr->source2 == sup[i]->destReg && iterator->theInstr->source2_ready == 0 &&
-					iterator->theInstr->source2_tag == sup[i]->dest_tag) {
-						iterator->theInstr->source2_ready = 1; // Set to ready
-						iterator->theInstr->source2_tag = -5; // set to default
-					}
-					
-				// Now, just check if both source 1 and 2 are ready for the instruction.
-				// If so, then just mark the instruction as 'fired'
-				if(iterator->theInstr->source1_ready && iterator->theInstr->source2_ready) {
-					assert(iterator->fired == 0); // Has to be true
-					iterator->fired = 1; // This instruction is eligible to move to exec next cycle
+ * Every waiting source in the queue gets compared against every tag in state 
+ * update, a word of slots at a time. That's slots times result buses of work 
+ * every cycle instead of one step per real consumer, which is why the lists 
+ * are the default
+ */
+void broadcastMatchTags(proc_sim *sim) {
+	int numTags = 0;
+	for(int i = 0; i < sim->curr_Config.num_r_bus; i++) {
+		if(sim->sup[i] != NULL)
+			sim->broadcast_tags[numTags++] = sim->sup[i]->dest_tag;
+	}
+	if(numTags == 0)
+		return;
+
+	for(int i = 0; i < sim->num_sched_queues; i++) {
+		schedule_queue *q = &sim->sched_q[i];
+		int words = schedWordsUsed(q);
+		for(int w = 0; w < words; w++) {
+			uint64_t waiting = q->valid[w] & ~q->fired[w];
+			if(waiting == 0)
+				continue;
+			
+			uint64_t woken = 0;
+			for(int src = 0; src < 2; src++) {
+				uint64_t notReady = waiting & ~q->src_ready[src][w];
+				if(notReady == 0)
+					continue; // Nothing in this word is waiting on this source
+				uint64_t match = sim->wakeup_match(&q->wait_tag[src][w << 6], notReady, sim->broadcast_tags, numTags);
+				q->src_ready[src][w] |= match; // Set to ready
+				woken |= match;
+				while(match != 0) {
+					q->wait_tag[src][(w << 6) + __builtin_ctzll(match)] = -5; // set to default
+					match &= match - 1;
 				}
 			}
-			iterator = iterator->next;
+			
+			// Now, just check if both source 1 and 2 are ready for the instructions 
+			// that just woke up. If so, then just mark them as 'fired'
+			q->fired[w] |= woken & q->src_ready[0][w] & q->src_ready[1][w];
 		}
 	}
 	return;
@@ -828,194 +1569,138 @@ void broadcastToSched() {
  * This function just deletes the nodes from the scheduling queue that correspond 
  * to the instructions that are currently in state update
  */
-void removeAllSUFromSched() {
-	int numSUElements = curr_Config->num_r_bus;
+void removeAllSUFromSched(proc_sim *sim) {
+	int numSUElements = sim->curr_Config.num_r_bus;
 	
 	for(int i = 0; i < numSUElements; i++) {
-		if(sup[i] == NULL)
+		if(sim->sup[i] == NULL)
 			continue;
-		removeFromSched(sup[i]);
+		removeFromSched(sim, sim->sup[i]);
 	}
 	return;
 }
 
 /*
- * Helper function to just remove nodes in the SU from the scheduling queue
+ * Helper function to just remove nodes in the SU from the scheduling queue. 
+ * Every instruction knows its own slot, so there's nothing to search for
  */
-void removeFromSched(instr *theInstr) {
-	schedule_node *iterator = schedule_head;
-	
-	// Handle case where the head node node we want to remove
-	if(iterator->theInstr == theInstr) {
-		assert(iterator->fired == 1);
-		assert(iterator->sendToExecute == 1);
-		assert(iterator->waiting == 1);
-		
-		// Move schedule head to next node
-		schedule_head = iterator->next;
-		
-		// Set prev pointer to null
-		if(schedule_head != NULL)
-			schedule_head->prev = NULL;
-		
-		// free old head
-		free(iterator);
-		schedule_size--;
-		
-		return;
-	}
+void removeFromSched(proc_sim *sim, instr *theInstr) {
+	schedule_queue *q = schedQueueFor(sim, sim->inflight.fu_class[theInstr->id]);
+	int slot = sim->inflight.sched_slot[theInstr->id];
 	
-	// handle the case where the node to remove is in the middle
-	while(iterator->next != NULL) {
-		if(iterator->theInstr == theInstr) {
-			assert(iterator->fired == 1);
-			assert(iterator->sendToExecute == 1);
-			assert(iterator->waiting == 1);
-			
-			// Set previous node's next to iterator's next
-			iterator->prev->next = iterator->next;
-			// Set next node's prev to iterator's prev
-			iterator->next->prev = iterator->prev;
-			// free iterator
-			free(iterator);
-			schedule_size--;
-			return;
-		}
-		iterator = iterator->next;
-	}
+	assert(slot >= 0 && slot < q->tail);
+	assert(q->entries[slot] == theInstr && bitTest(q->valid, slot)); // has to be here...
+	assert(bitTest(q->fired, slot));
+	assert(bitTest(q->sendToExecute, slot));
+	assert(bitTest(q->waiting, slot));
 	
-	// Lastly handle the case where the node is at the end
-	assert(iterator->theInstr == theInstr); // has to be here...
-	assert(iterator->fired == 1);
-	assert(iterator->sendToExecute == 1);
-	assert(iterator->waiting == 1);
+	// Clear out the slot so it's a hole
+	schedDrop(sim, q, slot);
 	
-	// set the previous node's next to null
-	iterator->prev->next = NULL;
-	// Free iterator
-	free(iterator);
-	// lower size
-	schedule_size--;
+	// If it was the youngest entry or the last one there's no hole to leave
+	if(q->count == 0)
+		q->tail = 0;
+	else if(slot == q->tail - 1)
+		q->tail--;
 	return;
 }
 
+/*
+ * Helper function that empties a slot of the scheduling queue and leaves a hole
+ */
+void schedDrop(proc_sim *sim, schedule_queue *q, int slot) {
+	int id = q->entries[slot]->id;
+	int fuClass = sim->inflight.fu_class[id];
+	if(fuClass >= 0)
+		q->class_count[fuClass]--;
+	sim->inflight.sched_slot[id] = -1;
+	q->entries[slot] = NULL;
+	
+	// All of the bitmaps are one allocation, a queue's worth of words apart, 
+	// so the slot's bit can be cleared in every one of them with one mask
+	uint64_t keep = ~(1ULL << (slot & 63));
+	uint64_t *word = &q->valid[slot >> 6];
+	for(int m = 0; m < SCHED_NUM_MAPS; m++)
+		word[m * q->words] &= keep;
+	q->count--;
+}
+
 /*
  * This function looks through all of the instructions in all of the FUs, and
- * chooses r of them to mark to be sent to state update in the next cycle. These 
- * r should be the instructions in tag order. So just find the r lowest tagged
- * instructions, and mark them as chosen
+ * chooses r of them to mark to be sent to state update in the next cycle. Only 
+ * instructions that have finished executing by the end of this cycle can be 
+ * chosen. It's not just who has the lowest tag, but it's also who has been 
+ * waiting to move on the longest AND THEN who has the lowest tag, which is 
+ * exactly the order the FU entries are kept in by the heap. So just pop 
+ * finished entries off the heap until we have r of them
  */ 
-void setToChosen() {
-	// Maybe the easiest way to do this is to just to look at all of the FU's 
-	// r times, and each time just mark the min as chosen. On each subsequent 
-	// search, don't consider any execution nodes that have already been marked
-	// as chosen when trying to find the minimum
-	int numPossible = getNumPossible(); // Number of filled FU spots
-	int numDesired = curr_Config->num_r_bus; // Max entries that could be chosen
+void setToChosen(proc_sim *sim, int64_t clock) {
+	int numDesired = sim->curr_Config.num_r_bus; // Max entries that could be chosen
 	
-	execute_node *minNode;
-	while(numPossible > 0 && numDesired > 0) {
-		// Note, it's not just who has the lowest tag, but it's also who has
-		// been waiting to move on the longest AND THEN who has the lowest tag
-		minNode = getMinNode(); 
+	while(sim->exec_heap_size > 0 && numDesired > 0 && sim->exec_heap[0]->done_cycle <= clock) {
+		execute_node *minNode = execHeapPop(sim);
+		assert(minNode->chosen == 0);
 		minNode->chosen = 1;
-		
-		numPossible--;
+		sim->k[minNode->fu_class].chosen++;
+		sim->chosen_list[sim->num_chosen++] = minNode;
 		numDesired--;
 	}
 	return;
 }
 
 /*
- * Helper function to find the number of currently filled entries in all the FUs
+ * Helper function that orders FU entries by the cycle they finished executing 
+ * and then by tag
  */
-int getNumPossible() {
-	int numPossible = 0;
-	int i;
-	for(i = 0; i < curr_Config->k0_size; i++) {
-		if(k_0[i] != NULL)
-			numPossible++;
-	}
-	for(i = 0; i < curr_Config->k1_size; i++) {
-		if(k_1[i] != NULL)
-			numPossible++;
-	}
-	for(i = 0; i < curr_Config->k2_size; i++) {
-		if(k_2[i] != NULL)
-			numPossible++;
-	}
-	return numPossible;
+int execBefore(execute_node *a, execute_node *b) {
+	if(a->done_cycle != b->done_cycle)
+		return a->done_cycle < b->done_cycle;
+	return a->theInstr->dest_tag < b->theInstr->dest_tag;
 }
 
 /*
- * Helper function to find the min execute node in all the FU's
+ * Helper function to add a FU entry to the heap
  */
-execute_node *getMinNode() {
-	int minTag = INT_MAX;
-	int minCycle = findMinCycle();
-	execute_node *toReturn;
-	int i;
+void execHeapPush(proc_sim *sim, execute_node *node) {
+	execute_node **heap = sim->exec_heap;
+	int i = sim->exec_heap_size++;
 	
-	for(i = 0; i < curr_Config->k0_size; i++) {
-		if((k_0[i] != NULL) && (k_0[i]->chosen != 1) && (k_0[i]->theInstr->exec <= minCycle)) {
-			if(k_0[i]->theInstr->dest_tag < minTag) {
-				minTag = k_0[i]->theInstr->dest_tag;
-				minCycle = k_0[i]->theInstr->exec;
-				toReturn = k_0[i];
-			}
-		}
-	}
-	
-	for(i = 0; i < curr_Config->k1_size; i++) {
-		if((k_1[i] != NULL) && (k_1[i]->chosen != 1) && (k_1[i]->theInstr->exec <= minCycle)) {
-			if(k_1[i]->theInstr->dest_tag < minTag) {
-				minTag = k_1[i]->theInstr->dest_tag;
-				minCycle = k_1[i]->theInstr->exec;
-				toReturn = k_1[i];
-			}
-		}
-	}
-	
-	for(i = 0; i < curr_Config->k2_size; i++) {
-		if((k_2[i] != NULL) && (k_2[i]->chosen != 1) && (k_2[i]->theInstr->exec <= minCycle)) {
-			if(k_2[i]->theInstr->dest_tag < minTag) {
-				minTag = k_2[i]->theInstr->dest_tag;
-				minCycle = k_2[i]->theInstr->exec;
-				toReturn = k_2[i];
-			}
-		}
+	// Sift up
+	while(i > 0) {
+		int parent = (i - 1) / 2;
+		if(!execBefore(node, heap[parent]))
+			break;
+		heap[i] = heap[parent];
+		i = parent;
 	}
-	
-	return toReturn;
+	heap[i] = node;
 }
 
 /*
- * Helper function that looks through all of the FU's and finds the min entry 
- * point into the exec stage
+ * Helper function to take the first FU entry off the heap
  */
-int findMinCycle() {
-	int minCycle = INT_MAX;
-	int i;
+execute_node *execHeapPop(proc_sim *sim) {
+	execute_node **heap = sim->exec_heap;
+	execute_node *top = heap[0];
+	execute_node *last = heap[--sim->exec_heap_size];
+	int size = sim->exec_heap_size;
+	int i = 0;
 	
-	for(i = 0; i < curr_Config->k0_size; i++) {
-		if((k_0[i] != NULL) && (k_0[i]->chosen != 1) && (k_0[i]->theInstr->exec <= minCycle)) {
-			minCycle = k_0[i]->theInstr->exec;
-		}
-	}
-	
-	for(i = 0; i < curr_Config->k1_size; i++) {
-		if((k_1[i] != NULL) && (k_1[i]->chosen != 1) && (k_1[i]->theInstr->exec <= minCycle)) {
-			minCycle = k_1[i]->theInstr->exec;
-		}
-	}
-
-	for(i = 0; i < curr_Config->k2_size; i++) {
-		if((k_2[i] != NULL) && (k_2[i]->chosen != 1) && (k_2[i]->theInstr->exec <= minCycle)) {
-			minCycle = k_2[i]->theInstr->exec;
-		}
+	// Sift the last entry down from the root
+	while(1) {
+		int child = 2*i + 1;
+		if(child >= size)
+			break;
+		if(child + 1 < size && execBefore(heap[child + 1], heap[child]))
+			child++;
+		if(!execBefore(heap[child], last))
+			break;
+		heap[i] = heap[child];
+		i = child;
 	}
-	
-	return minCycle;
+	if(size > 0)
+		heap[i] = last;
+	return top;
 }
 
 /*
@@ -1026,156 +1711,264 @@ int findMinCycle() {
  * It then assigns instructions in the schedule queue to these FU's in increasing 
  * tag order.
  */
-void markForExecution() {
-	int k0_spots = numSpotsAvailable('j'); // K0
-	int k1_spots = numSpotsAvailable('k'); // K1
-	int k2_spots = numSpotsAvailable('l'); // K2
+void markForExecution(proc_sim *sim) {
+	int k0_spots = numSpotsAvailable(sim, 'j'); // K0
+	int k1_spots = numSpotsAvailable(sim, 'k'); // K1
+	int k2_spots = numSpotsAvailable(sim, 'l'); // K2
 	
-	markScheduleEntries(k0_spots, 'j'); // K0
-	markScheduleEntries(k1_spots, 'k'); // K1
-	markScheduleEntries(k2_spots, 'l'); // K2
+	markScheduleEntries(sim, k0_spots, 'j'); // K0
+	markScheduleEntries(sim, k1_spots, 'k'); // K1
+	markScheduleEntries(sim, k2_spots, 'l'); // K2
 }
 
 /*
  * Helper function to find the number of spots in the FU's that are available to
  * move things from the scheduling queue into at the start of the next cycle
  */
-int numSpotsAvailable(char FU) {
-	execute_node **funcUnit;
-	int numEntries;
-	int numAvailable = 0;
+int numSpotsAvailable(proc_sim *sim, char FU) {
+	func_unit *funcUnit;
 	
 	switch (FU) {
 		case 'j':
-			funcUnit = k_0;
-			numEntries = curr_Config->k0_size;
+			funcUnit = &sim->k[0];
 			break;
 		case 'k':
-			funcUnit = k_1;
-			numEntries = curr_Config->k1_size;
+			funcUnit = &sim->k[1];
 			break;
 		case 'l':
-			funcUnit = k_2;
-			numEntries = curr_Config->k2_size;
+			funcUnit = &sim->k[2];
 			break;
 		default:
-			break;
-	}
-	
-	for(int i = 0; i < numEntries; i++) {
-		if((funcUnit[i] == NULL) || (funcUnit[i]->chosen == 1))
-			numAvailable++;
+			return 0;
 	}
 	
-	return numAvailable;		
+	// Empty slots plus the ones that are leaving at the start of the next cycle. 
+	// Pipelined FUs can still only start one instruction each per cycle
+	int numAvailable = funcUnit->num_slots - funcUnit->occupied + funcUnit->chosen;
+	if(funcUnit->pipelined && numAvailable > funcUnit->size)
+		numAvailable = funcUnit->size;
+	return numAvailable;
 }
 
 /*
  * Helper function that just goes through the scheduling queue and marks certain
  * entries as ready for being sent to execution at the start of the next cycle
  */
-void markScheduleEntries(int openSpots, char FU) {
-	schedule_node *iterator = schedule_head;
-	int FU_1;
-	int FU_2;
-	
+void markScheduleEntries(proc_sim *sim, int openSpots, char FU) {
+	int c;
+
 	switch(FU) {
 		case 'j': // k_0 (FU Type 0)
-			FU_1 = 0;
-			FU_2 = 0;
+			c = 0;
 			break;
 		case 'k': // k_1 (1 and -1 run on Type 1 FU)
-			FU_1 = 1;
-			FU_2 = -1; 
+			c = 1;
 			break;
 		case 'l': // k_2
-			FU_1 = 2;
-			FU_2 = 2;
+			c = 2;
 			break;
 		default:
-			break;
+			return;
 	}
-	
-	while(iterator != NULL && openSpots > 0) {
-		if((iterator->fired == 1) && (iterator->waiting == 0) && (iterator->theInstr->funcUnit == FU_1 || 
-			iterator->theInstr->funcUnit == FU_2)) {
-				iterator->sendToExecute = 1;
-				openSpots--;
+
+	// A reservation station only has its own class in it, the unified queue
+	// has to be filtered
+	schedule_queue *q = &sim->sched_q[(sim->num_sched_queues == 1) ? 0 : c];
+	uint64_t *fuClass = q->fu_class[c];
+		
+	// Lower slots are older, so just take the lowest set bits first
+	int words = schedWordsUsed(q);
+	for(int w = 0; w < words && openSpots > 0; w++) {
+		uint64_t bits = q->fired[w] & ~q->waiting[w] & fuClass[w];
+		while(bits != 0 && openSpots > 0) {
+			int slot = (w << 6) + __builtin_ctzll(bits);
+			bits &= bits - 1;
+			bitSet(q->sendToExecute, slot);
+			openSpots--;
 		}
-		iterator = iterator->next;
 	}
 	return;
 }
 
-void printScheduleQueue() {
+void printScheduleQueue(proc_sim *sim) {
 	printf("address \t fired \t sendToExecute \t waiting \n");
-	schedule_node *iterator = schedule_head;
-	while(iterator != NULL) {
-		printf("%" PRIx64" \t %d \t %d \t %d \n", iterator->theInstr->address, iterator->fired, 
-			iterator->sendToExecute, iterator->waiting);
-		iterator = iterator->next;
+	for(int i = 0; i < sim->num_sched_queues; i++) {
+		schedule_queue *q = &sim->sched_q[i];
+		for(int slot = 0; slot < q->tail; slot++) {
+			if(!bitTest(q->valid, slot))
+				continue;
+			printf("%" PRIx64" \t %d \t %d \t %d \n", q->entries[slot]->address, bitTest(q->fired, slot),
+				bitTest(q->sendToExecute, slot), bitTest(q->waiting, slot));
+		}
 	}
 }
 
-void printFinalQueue() {
-	printf("INST\tFETCH\tDISP\tSCHED\tEXEC\tSTATE\n");
-	final_node *iterator = final_head;
-	int maxInst = 0;
-	long maxCycle = 0;
-	while(iterator != NULL) {
-		if(iterator->dest_tag + 1 > maxInst)
-			maxInst = iterator->dest_tag + 1;
-		if(iterator->state > maxCycle)
-			maxCycle = iterator->state;
-		iterator = iterator->next;
+/*
+ * Just prints the header for the per-instruction output. Rows get printed as 
+ * the instructions retire
+ */
+void printFinalHeader(proc_sim *sim) {
+	if(sim->curr_Config.stats_only == 0)
+		fprintf(sim->final_out, "INST\tFETCH\tDISP\tSCHED\tEXEC\tSTATE\n");
+}
+
+/*
+ * Called once the simulation is done. Everything has been printed by now, so 
+ * this just finishes off the stats that depend on the total runtime
+ */
+void printFinalQueue(proc_sim *sim) {
+	int64_t maxInst = sim->final_max_inst;
+	int64_t maxCycle = sim->final_max_cycle;
+	
+	if(sim->curr_Config.stats_only == 0) {
+		drainFinalWindow(sim);
+		assert(sim->final_next_tag == maxInst); // Every tag should have been printed
 	}
 	
 	// Now just deal with some stats stuff very quickly
-	myStats->totalRuntime = maxCycle;
-	myStats->predictionAcc = ((float)myStats->totalCorrectBranch)/((float)myStats->totalBranchInstr);
-	myStats->avgDispQueue = (myStats->avgDispQueue)/((float)maxCycle);
-	myStats->avgInstIssue = ((float)maxInst)/((float)maxCycle);
-	myStats->avgInstRet = ((float)maxInst)/((float)maxCycle);
+	sim->myStats.totalRuntime = maxCycle;
+	sim->myStats.predictionAcc = ((float)sim->myStats.totalCorrectBranch)/((float)sim->myStats.totalBranchInstr);
+	sim->myStats.avgDispQueue = ((float)sim->disp_queue_total)/((float)maxCycle);
+	sim->myStats.avgInstIssue = ((float)maxInst)/((float)maxCycle);
+	sim->myStats.avgInstRet = ((float)maxInst)/((float)maxCycle);
+	sim->myStats.icacheAccesses = sim->icache.accesses;
+	sim->myStats.icacheHits = sim->icache.hits;
+	sim->myStats.icacheHitRate = ((float)sim->icache.hits)/((float)sim->icache.accesses);
+	for(int c = 0; c < SCHED_FU_CLASSES; c++)
+		sim->myStats.avgSchedOccupancy[c] = ((float)sim->sched_occupancy_total[c])/((float)maxCycle);
 	
-	// Back to printing out the results
-	final_node **finalArray = (final_node **)malloc(sizeof(final_node *) * maxInst);
-	iterator = final_head;
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///////////////////////// Misc. Functions //////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * This helper function just gets the length of the dispatch queue (and
+ * whether dispatch is stalled) for this cycle, along with how full the
+ * scheduling queue is for each FU class
+ */
+void updateDispatchQueueSize(proc_sim *sim) {
+	int64_t size = sim->dispatch_q.count;
+	sim->disp_queue_total += size;
 	
-	while(iterator != NULL) {
-		finalArray[iterator->dest_tag] = iterator;
-		iterator = iterator->next;
-	}
+	if(size > sim->myStats.maxDispQueue)
+		sim->myStats.maxDispQueue = size;
 	
-	for(int i = 0; i < maxInst; i++) {
-		if(finalArray[i] == NULL)
-			continue;
-		printf("%d\t%d\t%d\t%d\t%d\t%d\t\n",finalArray[i]->dest_tag+1, 
-			finalArray[i]->fetch, finalArray[i]->disp, finalArray[i]->sched,
-			finalArray[i]->exec, finalArray[i]->state);
+	// Also count the cycles dispatch is waiting on a mispredicted branch
+	if(sim->stallDispatch == 1)
+		sim->myStats.stallCycles++;
+
+	// And how full the scheduling queue is for each FU class
+	for(int c = 0; c < SCHED_FU_CLASSES; c++) {
+		int64_t occupancy = schedOccupancy(sim, c);
+		sim->sched_occupancy_total[c] += occupancy;
+		if(occupancy > sim->myStats.maxSchedOccupancy[c])
+			sim->myStats.maxSchedOccupancy[c] = occupancy;
 	}
-	free(finalArray);
 	
 	return;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-///////////////////////// Misc. Functions //////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////
+/*
+ * Helper function that counts the scheduling queue entries of one FU class,
+ * whichever queue they're in
+ */
+int schedOccupancy(proc_sim *sim, int fuClass) {
+	int occupancy = 0;
+	for(int i = 0; i < sim->num_sched_queues; i++)
+		occupancy += sim->sched_q[i].class_count[fuClass];
+	return occupancy;
+}
 
 /*
- * This helper function just gets the length of the dispatch queue
+ * Helper function that says if dispatch could take an instruction from the 
+ * fetch queue this cycle
  */
-void updateDispatchQueueSize() {
-	long size = 0;
-	dispatch_node *iterator = dispatch_head;
-	while(iterator != NULL) {
-		size++;
-		iterator = iterator->next;
+int dispatchCanAccept(proc_sim *sim) {
+	dispatch_queue *q = &sim->dispatch_q;
+	if(sim->curr_Config.rob_size > 0 && sim->rob.count >= sim->rob.limit)
+		return 0;
+	return (sim->stallDispatch == 0) && (q->limit == 0 || q->count < q->limit);
+}
+
+/*
+ * Figure out the first cycle (starting at clock) where any of the stages in 
+ * here could change something, assuming the fetch queue has nothing it can 
+ * hand to dispatch. Everything only moves when something else moved the cycle 
+ * before, except for instructions finishing in the FUs, so if nothing is ready 
+ * to move right now the next thing that can happen is the oldest FU entry 
+ * finishing. Returns INT64_MAX if nothing is in flight at all
+ */
+int64_t getNextEventCycle(proc_sim *sim, int64_t clock) {
+	// Anything in state update or picked for it retires/broadcasts this cycle
+	if(stateEmpty(sim) == 0 || sim->num_chosen > 0)
+		return clock;
+
+	// A finished instruction at the head of the ROB can commit
+	if(sim->rob.count > 0 && dispatchAt(&sim->rob, 0)->state != 0)
+		return clock;
+	
+	// Dispatch moves or reserves spots in the scheduling queue
+	if(sim->dispatch_q.num_marked > 0)
+		return clock;
+	if(sim->dispatch_q.count > 0) {
+		schedule_queue *q = schedQueueFor(sim, schedClassOf(dispatchAt(&sim->dispatch_q, 0)->funcUnit));
+		if(q->count < q->limit)
+			return clock;
+	}
+
+	// Scheduling queue entries that are going to exec or could be marked for it
+	char FUs[SCHED_FU_CLASSES] = {'j', 'k', 'l'};
+	for(int i = 0; i < sim->num_sched_queues; i++) {
+		schedule_queue *q = &sim->sched_q[i];
+		int words = schedWordsUsed(q);
+		for(int w = 0; w < words; w++) {
+			if((q->sendToExecute[w] & ~q->waiting[w]) != 0 || q->newly_ready[w] != 0)
+				return clock;
+		}
+	}
+	for(int c = 0; c < SCHED_FU_CLASSES; c++) {
+		if(numSpotsAvailable(sim, FUs[c]) <= 0)
+			continue;
+		schedule_queue *q = &sim->sched_q[(sim->num_sched_queues == 1) ? 0 : c];
+		int words = schedWordsUsed(q);
+		for(int w = 0; w < words; w++) {
+			if((q->fired[w] & ~q->waiting[w] & q->fu_class[c][w]) != 0)
+				return clock;
+		}
 	}
-	myStats->avgDispQueue = myStats->avgDispQueue + ((float)size);
 	
-	if(size > myStats->maxDispQueue)
-		myStats->maxDispQueue = size;
+	// Otherwise we're just waiting for the FUs to finish something
+	if(sim->exec_heap_size > 0 && sim->curr_Config.num_r_bus > 0) {
+		int64_t done = sim->exec_heap[0]->done_cycle;
+		return (done > clock) ? done : clock;
+	}
+	return INT64_MAX;
+}
+
+/*
+ * The driver calls this instead of simulating cycles where nothing happens. 
+ * The only thing that would have changed in those cycles is the dispatch queue 
+ * stats, so just credit them the same way updateDispatchQueueSize would have
+ */
+void skipIdleCycles(proc_sim *sim, int64_t numCycles) {
+	int64_t size = sim->dispatch_q.count;
+	sim->disp_queue_total += size * numCycles;
+	
+	if(size > sim->myStats.maxDispQueue)
+		sim->myStats.maxDispQueue = size;
+	
+	if(sim->stallDispatch == 1)
+		sim->myStats.stallCycles += numCycles;
+
+	for(int c = 0; c < SCHED_FU_CLASSES; c++) {
+		int64_t occupancy = schedOccupancy(sim, c);
+		sim->sched_occupancy_total[c] += occupancy * numCycles;
+		if(occupancy > sim->myStats.maxSchedOccupancy[c])
+			sim->myStats.maxSchedOccupancy[c] = occupancy;
+	}
 	
 	return;
 }
@@ -1183,20 +1976,17 @@ void updateDispatchQueueSize() {
 /*
  * This helper function just returns the stats struct
  */
-stats *getStats() {
-	return myStats;
+stats *getStats(proc_sim *sim) {
+	return &sim->myStats;
 }
 
 /*
- * This function just frees our final queue 
+ * This function just frees our final reorder window
  */
-void freeFinalQueue() {
-	final_node *iterator = final_head;
-	while(iterator != NULL) {
-		final_node *temp = iterator;
-		iterator = iterator->next;
-		free(temp);
-	}
+void freeFinalQueue(proc_sim *sim) {
+	free(sim->final_window);
+	sim->final_window = NULL;
+	sim->final_window_size = 0;
 }
 
 
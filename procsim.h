@@ -5,6 +5,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include "trace.h"
+#include "pool.h"
+#include "predictor.h"
+#include "icache.h"
+#include "wakeup.h"
 
 static const uint64_t DEFAULT_R = 2;   
 static const uint64_t DEFAULT_F = 4;    
@@ -12,36 +17,80 @@ static const uint64_t DEFAULT_J = 3;
 static const uint64_t DEFAULT_K = 2;    
 static const uint64_t DEFAULT_L = 1;	
 
-// Just create an instruction struct that procsim_driver will use
+// Just create an instruction struct that procsim_driver will use. This is the 
+// cold part of the instruction, the wakeup/select state is in the in-flight 
+// table at id. Tags and cycles are 64 bits since long traces go past 2^31 of 
+// both, and the fields are ordered widest first so none of the space goes to 
+// padding
 typedef struct instr_t {
 	uint64_t address;
+	int64_t dest_tag;
+	
+	// These are just variables that store what the cycle was when the 
+	// instruction got moved to this stage
+	int64_t fetch;
+	int64_t disp;
+	int64_t sched;
+	int64_t exec;
+	int64_t state;
+	
+	int id; // Its slot in the in-flight table
 	int funcUnit;
 	int destReg;
-	int dest_tag;
 	int source1;
-	int source1_tag; 
-	int source1_ready;
-	
 	int source2;
-	int source2_tag;
-	int source2_ready;
-	
-	// These are just variables that store what the cycle was when the 
-	// instruction got moved to this stage
-	int fetch;
-	int disp;
-	int sched;
-	int exec;
-	int state;
 	
 	// These additional fields are just to help with branches
-	int branch; // is it a branch
-	int taken; // is the branch taken or not
-	int correct_pred; // was the branch prediction correct
-	int resolved; // was the branch resolved
+	int8_t branch; // is it a branch
+	int8_t taken; // is the branch taken or not
+	int8_t correct_pred; // was the branch prediction correct
+	int8_t resolved; // was the branch resolved
 	
 } instr;
 
+/**
+ * One entry of a producer's list of waiting consumers. These get added when 
+ * the consumer reads a not ready source from the register file, and the 
+ * producer's broadcast only has to wake up the instructions on its list
+ */
+typedef struct wakeup_node_t {
+	int consumer; // In-flight table id of the consumer
+	int source; // Which of the consumer's sources is waiting (1 or 2)
+	struct wakeup_node_t *next;
+} wakeup_node;
+
+/**
+ * The register status (rename) table. It's flat: a ready bitset with one bit 
+ * per architectural register, and next to it the tag and the instruction each 
+ * not ready register is waiting on. A ready register has the default tag -5
+ */
+typedef struct reg_status_table_t {
+	int num_regs;
+	uint64_t *ready;
+	int64_t *tag;
+	instr **producer;
+} reg_status_table;
+
+/**
+ * The wakeup/select state of every in-flight instruction, as a structure of 
+ * arrays indexed by the instruction's id. The arrays are narrow so each cache 
+ * line covers a lot of instructions. Ids are handed out when an instruction 
+ * is read from the trace and given back when it retires. The arrays double 
+ * when every id is in use, and the ids that are already out stay the same. 
+ * Once an instruction is in the scheduling queue the state of its sources 
+ * lives in the queue, the table just says where to find it
+ */
+typedef struct inflight_table_t {
+	int capacity;
+	int *free_ids; // Stack of the unused ids
+	int num_free;
+	instr **record; // The instr each id belongs to
+	int64_t *src_tag; // Tag each source read from the register file, [2*id] and [2*id + 1] (-5 if it was ready). Only used until it enters the scheduling queue
+	int8_t *fu_class; // Which FU class it runs on. Set when it enters the scheduling queue
+	int32_t *sched_slot; // Slot in the scheduling queue (-1 if not in it)
+	struct wakeup_node_t **consumers; // Instructions waiting on this one's result
+} inflight_table;
+
 // Create an IF list that the procsim_driver will use
 typedef struct if_listnode {
 	instr *theInstr;
@@ -49,33 +98,62 @@ typedef struct if_listnode {
 } if_listnode;
 
 /**
- * This is the struct that contains the dispatch queue. It is just 
- * a singly linked list since we just add them in order to the scheduling 
- * queue as long as there is space in the scheduling queue
+ * This is the struct that contains the dispatch queue. It is a ring buffer of 
+ * instructions in program order since we just add them in order to the 
+ * scheduling queue as long as there is space in the scheduling queue. The 
+ * capacity is always a power of 2. If the queue has a limit the ring is sized 
+ * to fit it and fetch just has to wait, otherwise it doubles when it fills up
  */
-typedef struct dispatch_node_t {
-	instr *theInstr;
-	struct dispatch_node_t *next;
-	// Flag that marks that this instruction will be moved to the scheduling 
-	// queue at the start of the next cycle. Also those instructions that are 
-	// marked will read from the register file at the right point in time 
-	// while they are in the dispatch queue
-	int mark_for_move;
-} dispatch_node; 
+typedef struct dispatch_queue_t {
+	instr **entries;
+	int capacity;
+	int head; // Index of the oldest instruction
+	int count; // Number of instructions in the queue
+	// The first num_marked instructions will be moved to the scheduling queue 
+	// at the start of the next cycle. Those are also the ones that read from 
+	// the register file while they are in the dispatch queue
+	int num_marked;
+	int limit; // Most instructions it can hold (0 means no limit)
+} dispatch_queue;
+
+// The reorder buffer and the replay queue are the same kind of ring buffer
+typedef dispatch_queue instr_ring;
 
 /**
- * This is a struct that contains the scheduling queue nodes. It is a doubly 
- * linked list since I'll end up having to deal with deleting things potentially
- * out of order
+ * This is the struct that contains the scheduling queue. Its size is fixed, so 
+ * it's just an array of slots kept in age order (a lower slot is always an 
+ * older instruction), and all of the per-entry flags are bitmaps over the 
+ * slots so a whole word of entries can be checked at once. Removed entries 
+ * leave a hole, and the holes get squeezed out when new entries reach the end
+ * of the array. There's either one of these shared by every FU class (unified) or 
+ * one per class (distributed reservation stations). The tags the sources are 
+ * waiting on are packed by slot too, so with the tag match wakeup the 
+ * broadcast is a vector compare of the result bus tags against a whole word 
+ * of slots at once
  */
-typedef struct scheduling_node_t {
-	instr *theInstr;
-	struct scheduling_node_t *next;
-	struct scheduling_node_t *prev;
-	int fired; // This just tells us if the instruction has been fired
-	int sendToExecute; // This is a flag that tells us if we should send to exec. at start of next cycle
-	int waiting;
-} schedule_node;
+#define SCHED_FU_CLASSES 3
+
+// Per-slot bitmaps in a scheduling queue: valid, fired, sendToExecute, 
+// waiting, newly_ready, the two src_ready and one per FU class
+#define SCHED_NUM_MAPS (7 + SCHED_FU_CLASSES)
+
+typedef struct schedule_queue_t {
+	instr **entries; // Instruction in each slot
+	int capacity; // Number of slots. A multiple of 64
+	int words; // Number of 64 bit words in each bitmap
+	int tail; // Next slot to fill
+	int count; // Number of live entries
+	int limit; // Most live entries it can have
+	int class_count[SCHED_FU_CLASSES]; // Live entries of each FU class
+	uint64_t *valid; // Slot holds an instruction
+	uint64_t *fired; // Both sources are ready
+	uint64_t *sendToExecute; // Will be sent to exec at the start of the next cycle
+	uint64_t *waiting; // Already in a FU, waiting for state update
+	uint64_t *newly_ready; // Was ready when it came in, gets fired by setToFired
+	uint64_t *src_ready[2]; // Each source is ready
+	uint64_t *fu_class[SCHED_FU_CLASSES]; // Which FU class the slot runs on
+	int64_t *wait_tag[2]; // Tag each source is waiting on (-5 once it's ready)
+} schedule_queue;
 
 /**
  * This is a struct of what will go into the FUs. It is essentially just the 
@@ -85,20 +163,54 @@ typedef struct scheduling_node_t {
  */
 typedef struct execute_node_t {
 	instr *theInstr;
+	int64_t done_cycle; // First cycle at the end of which the result is ready
 	int chosen; // Chosen to send to state update at the very start of the next cycle
+	int fu_class; // Which FU class this slot belongs to
+	int slot; // Index of this slot in its FU class
 } execute_node;
 
 /**
- * This struct contains the final information needed for printing
+ * All of the FUs of one class. The slots are stored inline and the empty ones 
+ * are kept on a stack, and the counters let us answer how many FUs will be 
+ * free next cycle without looking at the slots at all. An unpipelined FU has 
+ * one slot and is busy until its instruction leaves for state update. A 
+ * pipelined FU has one slot per stage and can take a new instruction every 
+ * cycle
+ */
+typedef struct func_unit_t {
+	execute_node *slots; // One per FU (times latency if pipelined)
+	int *free_slots; // Stack of the empty slots
+	int num_free;
+	int num_slots;
+	int size; // Number of FUs, which is also how many can start each cycle
+	int latency; // Cycles an instruction spends executing
+	int pipelined;
+	int occupied; // Slots holding an instruction, chosen or not
+	int chosen; // Occupied slots that go to state update at the start of the next cycle
+} func_unit;
+
+/**
+ * What the fetch stage can do with the next instruction this cycle
+ */
+typedef enum fetch_result_e {
+	FETCH_HOLD = 0, // Not this cycle (I-cache miss or the fetch block already ended)
+	FETCH_OK, // Goes in the fetch queue
+	FETCH_LAST // Goes in the fetch queue, but nothing else comes after it this cycle
+} fetch_result;
+
+/**
+ * This struct contains the final information needed for printing. Retired 
+ * instructions sit in a small tag-indexed reorder window of these until every 
+ * lower tag has retired, and then they get printed and the slot is reused. 
+ * The tag isn't stored since the window only prints the slot of final_next_tag
  */
 typedef struct final_node_t {
-	int dest_tag;
-	int fetch;
-	int disp;
-	int sched;
-	int exec;
-	int state;
-	struct final_node_t *next;
+	int64_t fetch;
+	int64_t disp;
+	int64_t sched;
+	int64_t exec;
+	int64_t state;
+	int valid; // Slot holds a retired instruction that hasn't been printed yet
 } final_node;
 
 
@@ -106,70 +218,154 @@ typedef struct final_node_t {
  * A struct for storing useful parameters of the simulation
  */
 typedef struct config_t {
-	int numRegs;
+	int numRegs; // Architectural registers. Trace register numbers have to be below this
 	int k0_size;
 	int k1_size;
 	int k2_size;
 	int num_r_bus;
-	int max_sched_queue;
+	int max_sched_queue; // Filled in by proc_init (all of the reservation stations together)
+	int sched_distributed; // One scheduling queue per FU class instead of one for all of them
+	int sched_size[SCHED_FU_CLASSES]; // Distributed: entries for each class (0 means 2*k). Unified: [0] is the total (0 means 2*(k0+k1+k2))
 	int fetch_rate;
+	int stats_only; // Don't print or store the per-instruction timing at all
+	int fetch_queue_size; // Most instructions waiting in fetch (0 means no limit)
+	int dispatch_queue_size; // Most instructions in the dispatch queue (0 means no limit)
+	predictor_config predictor; // Which branch predictor and how big (all 0 is the original GSelect)
+	int rob_size; // Reorder buffer entries. 0 keeps the original stall on mispredictions
+	int mispredict_penalty; // Extra cycles before fetch restarts after a squash
+	icache_config icache; // I-cache geometry (size 0 means every fetch hits)
+	int fetch_break_taken; // Fetch blocks end at predicted taken branches
+	int fu_latency[SCHED_FU_CLASSES]; // Execute latency of k_0, k_1 and k_2 (0 means 1)
+	int fu_pipelined[SCHED_FU_CLASSES]; // Can the FUs of each class start one every cycle
+	int wakeup_match; // Wake up the scheduler by matching every entry's tags instead of the producers' consumer lists
 } config;
 
 /**
  * A struct for storing useful stats of the simulation
  */
 typedef struct stats_t {
-	long totalBranchInstr;
-	long totalCorrectBranch;
+	int64_t totalBranchInstr;
+	int64_t totalCorrectBranch;
 	float predictionAcc;
 	float avgDispQueue;
-	long maxDispQueue;
+	int64_t maxDispQueue;
 	float avgInstIssue;
 	float avgInstRet;
-	long totalRuntime;
+	int64_t totalRuntime;
+	int64_t stallCycles; // Cycles dispatch spent stalled on a mispredicted branch
+	int64_t icacheAccesses; // Only counted with an I-cache model
+	int64_t icacheHits;
+	float icacheHitRate;
+	float avgSchedOccupancy[SCHED_FU_CLASSES]; // Scheduling queue entries of each FU class per cycle
+	int64_t maxSchedOccupancy[SCHED_FU_CLASSES];
 } stats;
 
 
+/**
+ * The simulator context. This holds all of the state of one simulated 
+ * processor, so any number of them can be run side by side (even on different 
+ * threads) as long as each one is only touched by one thread at a time
+ */
+typedef struct proc_sim_t {
+	dispatch_queue dispatch_q; // Dispatch queue
+	schedule_queue sched_q[SCHED_FU_CLASSES]; // Scheduling queue (distributed: one per FU class)
+	int num_sched_queues; // 1 for unified, SCHED_FU_CLASSES for distributed
+	final_node *final_window; // Reorder window of retired instructions, indexed by tag % size
+	int final_window_size; // Number of slots in the reorder window
+	int64_t final_next_tag; // Lowest tag that hasn't been printed yet
+	int64_t final_max_inst; // Highest retired tag + 1
+	int64_t final_max_cycle; // Latest state update cycle seen so far
+	FILE *final_out; // Where the retired instructions get printed
+	instr **sup; // State update array. Of size r (number of common data buses)
+	reg_status_table reg_status; // Register file. It holds ready, tag and producer
+	inflight_table inflight; // Wakeup/select state of every in-flight instruction
+	wakeup_kernel wakeup_match; // Tag compare for the broadcast (picked for this CPU). Only with the tag match wakeup
+	int64_t *broadcast_tags; // This cycle's result bus tags. Of size r
+	func_unit k[SCHED_FU_CLASSES]; // functional units k_0, k_1 and k_2
+	execute_node **exec_heap; // Min-heap of the unchosen FU entries by (done cycle, tag)
+	int exec_heap_size;
+	execute_node **chosen_list; // FU entries chosen for state update. Of size r
+	int num_chosen;
+	config curr_Config; // Config structure that contains useful parameter constants
+	branch_predictor predictor; // Our branch predictor and its GHR
+	int stallDispatch; // A lock for our dispatch queue
+	instr_ring rob; // Every dispatched instruction until it commits (only with a ROB)
+	instr_ring replay; // Squashed instructions (or one held by fetch) waiting to be fetched again, oldest first
+	instr_ring replay_spare; // What a squash builds the next replay queue in before the two swap
+	int64_t fetch_resume; // First cycle fetch can run again after a squash or I-cache miss
+	icache icache; // Only set up if the config has an I-cache
+	uint64_t fetch_line; // Line + 1 of the I-cache line this cycle's fetch block is in
+	uint64_t fetch_miss_line; // Line + 1 of the I-cache miss fetch is waiting on (0 if none)
+	int64_t fetch_miss_ready; // Cycle that line gets filled
+	stats myStats; // A struct for our stats to be stored in
+	// Running totals behind the per-cycle averages. They're whole numbers, so 
+	// they're kept exactly and only turned into floats at the end
+	int64_t disp_queue_total;
+	int64_t sched_occupancy_total[SCHED_FU_CLASSES];
+	
+	// Free-list pools for everything that gets created per instruction
+	node_pool instr_pool;
+	node_pool fetch_pool;
+	node_pool wakeup_pool;
+} proc_sim;
+
+
 /*
  * Functions I need to declare for procsim_driver. Declared in order of appearence
  */ 
  
-// Initialization Function
-void proc_init(int numRegs, int k0_size, int k1_size, int k2_size, int num_r_bus, int fetch_rate); // Initialize my globals
+// Initialization/Cleanup Functions
+int proc_init(proc_sim *sim, const config *settings); // Initialize a simulator context
+void proc_free(proc_sim *sim);
+instr *instrAlloc(proc_sim *sim); // A new instruction with its in-flight state reset
+void instrFree(proc_sim *sim, instr *theInstr);
 
 // Functions that help identify when to stop the simulation
-int stateEmpty();
-dispatch_node *getDispHead(); 
-schedule_node *getScheduleHead();
+int stateEmpty(proc_sim *sim);
+int getDispSize(proc_sim *sim); 
+int getScheduleSize(proc_sim *sim);
+int speculationEmpty(proc_sim *sim);
 
 // Functions to transition at the start of the cycle
-void sendToFinal();
-void sendToSU(int clock);
-void resolveBranches();
-void moveToExecute(int clock);
-void dispatchToSchedule(int clock, int totalMarked);
-void dispatch_Enqueue(if_listnode **fetch_head, int cycle);
-int getPrediction(uint64_t address);
+int sendToFinal(proc_sim *sim);
+void sendToSU(proc_sim *sim, int64_t clock);
+int resolveBranches(proc_sim *sim, int64_t clock, if_listnode **fetch_head);
+void moveToExecute(proc_sim *sim, int64_t clock);
+void dispatchToSchedule(proc_sim *sim, int64_t clock, int totalMarked);
+int dispatch_Enqueue(proc_sim *sim, if_listnode **fetch_head, int64_t cycle);
+int getPrediction(proc_sim *sim, uint64_t address);
+instr *replayNext(proc_sim *sim);
+fetch_result fetchInstr(proc_sim *sim, instr *theInstr, int64_t clock, int numFetched);
+int fetchHold(proc_sim *sim, instr *theInstr);
 
 // Then just update some stats needed
-void updateDispatchQueueSize();
+void updateDispatchQueueSize(proc_sim *sim);
+
+// Jumping over cycles where nothing can happen
+int dispatchCanAccept(proc_sim *sim);
+int64_t getNextEventCycle(proc_sim *sim, int64_t clock);
+void skipIdleCycles(proc_sim *sim, int64_t numCycles);
 
 // Then simulate the mid-cycle happenings
-void writeToRegFile();
-void setToFired();
-int reserveScheduleSpots();
-void readUpdateRegFile(int totalMarked);
-void broadcastToSched();
-void removeAllSUFromSched();
+void writeToRegFile(proc_sim *sim);
+void setToFired(proc_sim *sim);
+int reserveScheduleSpots(proc_sim *sim);
+int readUpdateRegFile(proc_sim *sim, int totalMarked);
+void broadcastToSched(proc_sim *sim);
+void removeAllSUFromSched(proc_sim *sim);
 
 // Mark Instructions at various stages as ready to move to the next stage
-void setToChosen();
-void markForExecution();
+void setToChosen(proc_sim *sim, int64_t clock);
+void markForExecution(proc_sim *sim);
 
 // Print/Stats/Cleanup Functions Needed
-void printScheduleQueue();
-void printFinalQueue();
-stats *getStats();
-void freeFinalQueue();
+void printScheduleQueue(proc_sim *sim);
+void printFinalHeader(proc_sim *sim);
+void printFinalQueue(proc_sim *sim);
+stats *getStats(proc_sim *sim);
+void freeFinalQueue(proc_sim *sim);
+
+// Defined in procsim_driver.c. Runs a whole trace through a context
+int runSimulation(proc_sim *sim, trace_reader *reader);
  
 #endif /* PROCSIM_H */
@@ -1,9 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <unistd.h>
 #include <getopt.h>
 #include "procsim.h"
+#include "trace.h"
+#include "sweep.h"
 #include "assert.h"
 
 void print_help_and_exit(void) {
@@ -13,19 +16,48 @@ void print_help_and_exit(void) {
     printf("  -j J\t\tNumber of k_0 fu's\n");
     printf("  -k K\t\tNumber of k_1 fu's\n");
 	printf("  -l L\t\tNumber of k_2 fu's\n");
+    printf("  -J N\t\tLatency of the k_0 fu's in cycles (default 1)\n");
+    printf("  -K N\t\tLatency of the k_1 fu's in cycles (default 1)\n");
+    printf("  -L N\t\tLatency of the k_2 fu's in cycles (default 1)\n");
+    printf("  -p P\t\tWhich fu classes are pipelined, any of 'jkl' (default none)\n");
+    printf("  -P P\t\tBranch predictor: gselect, gshare, bimodal, tournament or tage\n");
+    printf("  -T T\t\tlog2 of the predictor table size (default depends on -P)\n");
+    printf("  -H H\t\tPredictor global history bits (default depends on -P)\n");
+    printf("  -Q Q\t\tFetch queue capacity (default unbounded)\n");
+    printf("  -D D\t\tDispatch queue capacity (default unbounded)\n");
+    printf("  -R N\t\tReorder buffer entries, squash instead of stalling on mispredictions (default off)\n");
+    printf("  -M N\t\tCycles before fetch restarts after a squash (default 0)\n");
+    printf("  -C N\t\tI-cache size in KB (default none, every fetch hits)\n");
+    printf("  -A N\t\tI-cache associativity (default 4)\n");
+    printf("  -B N\t\tI-cache line size in bytes (default 64)\n");
+    printf("  -m N\t\tI-cache miss latency in cycles (default 10)\n");
+    printf("  -c\t\tEnd each fetch block at a predicted taken branch\n");
+    printf("  -n N\t\tNumber of architectural registers (default 128)\n");
+    printf("  -S S\t\tScheduler: N for a unified queue of N, 'distributed' or J,K,L for per-class stations\n");
+    printf("  -w\t\tWake up the scheduler with a SIMD tag match over every entry (same results, usually slower)\n");
     printf("  -i I\t\t tracefileName\n");
+    printf("  -b B\t\t binary tracefileName (made by procsim_convert)\n");
+    printf("  -s\t\tOnly print the stats (no per-instruction timing)\n");
+    printf("  -x X\t\tSweep every 'R F J K L' configuration in file X\n");
+    printf("  -X X\t\tPredictor-only sweep of every 'PREDICTORS T H' line in file X\n");
+    printf("  -o O\t\tWrite the sweep results to O (.csv or .json)\n");
+    printf("  -t T\t\tNumber of sweep threads (default one per core)\n");
     exit(0);
 }
 
 // Create a struct of the instruction data from what was just read by the file
-instr *createInstruction(uint64_t address, int fu, int dest, int src1, int src2, 
-	int src1_tag, int src2_tag, int tag, int clock, int branch, int taken, int correct, 
+instr *createInstruction(proc_sim *sim, uint64_t address, int fu, int dest, int src1, int src2, 
+	int64_t tag, int64_t clock, int branch, int taken, int correct, 
 	int resolved);
 // add the instruction data to a list that will be moved to dispatch in the next
 // cycle
-if_listnode *addToFetchQueue(if_listnode **fetchQueue, if_listnode *fetchQueueTail, instr *currInstr);
+if_listnode *addToFetchQueue(proc_sim *sim, if_listnode **fetchQueue, if_listnode *fetchQueueTail, instr *currInstr);
 // Just print the stats struct
-void printStats();
+void printStats(proc_sim *sim);
+// Is a trace register number something the register file has (-1 is none)
+int regInRange(int reg, int numRegs);
+// Read the -S argument into the scheduler settings
+int parseScheduler(const char *arg, int *distributed, int *sizes);
 
 
 int main(int argc, char* argv[]) {
@@ -35,10 +67,31 @@ int main(int argc, char* argv[]) {
     int k_0 = DEFAULT_J;
 	int k_1 = DEFAULT_K;
 	int k_2 = DEFAULT_L;
+	int stats_only = 0;
+	int latency[SCHED_FU_CLASSES] = {1, 1, 1};
+	int pipelined[SCHED_FU_CLASSES] = {0, 0, 0};
+	int fetchQueueSize = 0;
+	int dispatchQueueSize = 0;
+	int robSize = 0;
+	int mispredictPenalty = 0;
+	int fetchBreakTaken = 0;
+	int numRegs = 128; // Registers [0,...,127] unless -n says otherwise
+	int schedDistributed = 0;
+	int schedSizes[SCHED_FU_CLASSES] = {0, 0, 0}; // 0 means the usual 2 per FU
+	int wakeupMatch = 0;
+	predictor_config predictor;
+	memset(&predictor, 0, sizeof(predictor)); // GSelect with the original 128x8 table
+	icache_config icacheSettings;
+	memset(&icacheSettings, 0, sizeof(icacheSettings)); // No I-cache
     FILE* fin  = stdin;
+    char *binaryTrace = NULL;
+    char *sweepFile = NULL;
+    char *predSweepFile = NULL;
+    char *sweepOut = NULL;
+    int sweepThreads = 0;
 
     /* Read arguments */ 
-    while(-1 != (opt = getopt(argc, argv, "r:f:j:k:l:i:h"))) {
+    while(-1 != (opt = getopt(argc, argv, "r:f:j:k:l:J:K:L:p:P:T:H:Q:D:R:M:C:A:B:m:cn:S:wi:b:sx:X:o:t:h"))) {
         switch(opt) {
             case 'r':
                 r = atoi(optarg);
@@ -55,9 +108,98 @@ int main(int argc, char* argv[]) {
             case 'l':
                 k_2 = atoi(optarg);
                 break;
+            case 'J':
+                latency[0] = atoi(optarg);
+                if(latency[0] <= 0)
+                    print_help_and_exit();
+                break;
+            case 'K':
+                latency[1] = atoi(optarg);
+                if(latency[1] <= 0)
+                    print_help_and_exit();
+                break;
+            case 'L':
+                latency[2] = atoi(optarg);
+                if(latency[2] <= 0)
+                    print_help_and_exit();
+                break;
+            case 'p':
+                // Letters name the classes the same way as -j/-k/-l
+                for(char *c = optarg; *c != '\0'; c++) {
+                    if(*c == 'j') pipelined[0] = 1;
+                    else if(*c == 'k') pipelined[1] = 1;
+                    else if(*c == 'l') pipelined[2] = 1;
+                    else print_help_and_exit();
+                }
+                break;
+            case 'P':
+                if(predictorParseType(optarg, &predictor.type) != 0)
+                    print_help_and_exit();
+                break;
+            case 'T':
+                predictor.table_bits = atoi(optarg);
+                break;
+            case 'H':
+                predictor.history_bits = atoi(optarg);
+                break;
+            case 'Q':
+                fetchQueueSize = atoi(optarg);
+                break;
+            case 'D':
+                dispatchQueueSize = atoi(optarg);
+                break;
+            case 'R':
+                robSize = atoi(optarg);
+                break;
+            case 'M':
+                mispredictPenalty = atoi(optarg);
+                break;
+            case 'C':
+                icacheSettings.size_kb = atoi(optarg);
+                break;
+            case 'A':
+                icacheSettings.ways = atoi(optarg);
+                break;
+            case 'B':
+                icacheSettings.line_size = atoi(optarg);
+                break;
+            case 'm':
+                icacheSettings.miss_latency = atoi(optarg);
+                break;
+            case 'c':
+                fetchBreakTaken = 1;
+                break;
+            case 'n':
+                numRegs = atoi(optarg);
+                break;
+            case 'S':
+                if(parseScheduler(optarg, &schedDistributed, schedSizes) != 0)
+                    print_help_and_exit();
+                break;
+            case 'w':
+                wakeupMatch = 1;
+                break;
             case 'i':
                 fin = fopen(optarg, "r");
                 break;
+            case 'b':
+                binaryTrace = optarg;
+                break;
+            case 's':
+                stats_only = 1;
+                break;
+            case 'x':
+                sweepFile = optarg;
+                break;
+            case 'X':
+                predSweepFile = optarg;
+                break;
+            case 'o':
+                sweepOut = optarg;
+                break;
+            case 't':
+                sweepThreads = atoi(optarg);
+                break;
             case 'h':
             default:
                 print_help_and_exit();
@@ -65,6 +207,73 @@ int main(int argc, char* argv[]) {
         }
     }
 
+	if(numRegs <= 0) {
+		fprintf(stderr, "Need at least one register\n");
+		return -1;
+	}
+
+	// Fill in the predictor sizes that weren't given
+	if(predictorFillDefaults(&predictor) != 0) {
+		fprintf(stderr, "Predictor tables are too big\n");
+		return -1;
+	}
+	if(icacheSettings.size_kb > 0 && icacheFillDefaults(&icacheSettings) != 0) {
+		fprintf(stderr, "I-cache size, ways and line size have to give a power of 2 number of sets\n");
+		return -1;
+	}
+
+	// Open up the trace. Binary traces just get mapped into memory
+	trace_reader reader;
+	if(binaryTrace != NULL) {
+		if(traceOpenBinary(&reader, binaryTrace) != 0) {
+			fprintf(stderr, "Could not read binary trace %s\n", binaryTrace);
+			return -1;
+		}
+	} else if(traceOpenText(&reader, fin) != 0) {
+		fprintf(stderr, "Could not open the trace\n");
+		return -1;
+	}
+
+	// The predictor-only sweep doesn't need a processor at all
+	if(predSweepFile != NULL) {
+		int ret = runPredictorSweep(predSweepFile, &reader, sweepThreads, sweepOut);
+		traceClose(&reader);
+		return ret;
+	}
+
+	// Setup the processor
+	config settings;
+	memset(&settings, 0, sizeof(settings));
+	settings.numRegs = numRegs;
+	settings.k0_size = k_0;
+	settings.k1_size = k_1;
+	settings.k2_size = k_2;
+	settings.num_r_bus = r;
+	settings.fetch_rate = f;
+	settings.stats_only = stats_only;
+	settings.fetch_queue_size = fetchQueueSize;
+	settings.dispatch_queue_size = dispatchQueueSize;
+	settings.predictor = predictor;
+	settings.rob_size = robSize;
+	settings.mispredict_penalty = mispredictPenalty;
+	settings.icache = icacheSettings;
+	settings.fetch_break_taken = fetchBreakTaken;
+	settings.sched_distributed = schedDistributed;
+	settings.wakeup_match = wakeupMatch;
+	for(int c = 0; c < SCHED_FU_CLASSES; c++)
+		settings.sched_size[c] = schedSizes[c];
+	for(int c = 0; c < SCHED_FU_CLASSES; c++) {
+		settings.fu_latency[c] = latency[c];
+		settings.fu_pipelined[c] = pipelined[c];
+	}
+	
+	// In sweep mode the sizes come from the sweep file instead
+	if(sweepFile != NULL) {
+		int ret = runSweep(sweepFile, &settings, &reader, sweepThreads, sweepOut);
+		traceClose(&reader);
+		return ret;
+	}
+
 	// Just print out the processor settings
     printf("Processor Settings\n");
     printf("R: %d\n", r);
@@ -72,10 +281,77 @@ int main(int argc, char* argv[]) {
     printf("k1: %d\n", k_1);
     printf("k2: %d\n", k_2);
     printf("F: %d\n", f);
+	// Only mention the latencies if they aren't the usual single cycle ones
+	for(int c = 0; c < SCHED_FU_CLASSES; c++) {
+		if(latency[c] != 1 || pipelined[c])
+			printf("k%d latency: %d%s\n", c, latency[c], pipelined[c] ? " (pipelined)" : "");
+	}
+	if(predictor.type != PRED_GSELECT || predictor.table_bits != 7 || predictor.history_bits != 3)
+		printf("Predictor: %s (table bits %d, history bits %d)\n", predictorName(predictor.type), 
+			predictor.table_bits, predictor.history_bits);
+	if(fetchQueueSize > 0)
+		printf("Fetch queue: %d\n", fetchQueueSize);
+	if(dispatchQueueSize > 0)
+		printf("Dispatch queue: %d\n", dispatchQueueSize);
+	if(robSize > 0)
+		printf("ROB: %d (mispredict penalty %d)\n", robSize, mispredictPenalty);
+	if(icacheSettings.size_kb > 0)
+		printf("I-cache: %dKB, %d way, %dB lines, %d cycle miss\n", icacheSettings.size_kb, 
+			icacheSettings.ways, icacheSettings.line_size, icacheSettings.miss_latency);
+	if(fetchBreakTaken)
+		printf("Fetch blocks end at predicted taken branches\n");
+	if(numRegs != 128)
+		printf("Registers: %d\n", numRegs);
+	if(schedDistributed)
+		printf("Reservation stations: %d, %d, %d\n", (schedSizes[0] > 0) ? schedSizes[0] : 2*k_0, 
+			(schedSizes[1] > 0) ? schedSizes[1] : 2*k_1, (schedSizes[2] > 0) ? schedSizes[2] : 2*k_2);
+	else if(schedSizes[0] > 0)
+		printf("Scheduling queue: %d\n", schedSizes[0]);
     printf("\n");
 	
-	// Setup the processor
-	proc_init(128, k_0, k_1, k_2, r, f); // Assume 128 registers [0,...,127]
+	proc_sim sim;
+	if(proc_init(&sim, &settings) != 0) {
+		fprintf(stderr, "Could not allocate the simulator\n");
+		return -1;
+	}
+	
+	// Instructions get printed as they retire, so the header has to go first
+	printFinalHeader(&sim);
+	
+	// Parse the trace on another thread while this one simulates. Binary 
+	// traces don't need it, so this leaves them alone
+	if(traceStartReader(&reader) != 0) {
+		fprintf(stderr, "Could not start the trace reader\n");
+		traceClose(&reader);
+		proc_free(&sim);
+		return -1;
+	}
+	
+	// Run the whole trace through the processor
+	if(runSimulation(&sim, &reader) != 0) {
+		traceClose(&reader);
+		proc_free(&sim);
+		return -1;
+	}
+	traceClose(&reader);
+	
+	printf("\n");
+	printStats(&sim);
+	proc_free(&sim);
+	
+    return 0;
+}
+
+/*
+ * Runs every instruction of the trace through the processor until all of the 
+ * queues have drained and then finishes off the stats. The trace reader and 
+ * the simulator context are the only state, so this can be run on several 
+ * threads at once with separate contexts and readers
+ */
+int runSimulation(proc_sim *sim, trace_reader *reader) {
+	int f = sim->curr_Config.fetch_rate;
+	int numRegs = sim->curr_Config.numRegs;
+	int fetchLimit = sim->curr_Config.fetch_queue_size; // 0 means no limit
 	
 	// Now just create an instruction fetch stage list. All the other stages 
 	// are taken care of by procsim.c, but since we read the file here, it 
@@ -83,26 +359,25 @@ int main(int argc, char* argv[]) {
 	// the fetched instructions in
 	if_listnode **fetchQueue;
 	if_listnode *fetchQueueTail = NULL;
+	int fetchCount = 0; // Instructions sitting in the fetch queue
 	fetchQueue = (if_listnode **)malloc(sizeof(if_listnode *) * 1);
 	if(fetchQueue == NULL)
 		return -1;
+	fetchQueue[0] = NULL;
 
     /* Begin reading the file */ 
-    uint64_t address;
-	int fu_type;
-	int dest_reg;
-	int src_1;
-	int src_2;
-	int tag = 0;
-	int clock = 1;
+	trace_record rec;
+	int64_t tag = 0;
+	int64_t clock = 1;
 	int branch = 0;
 	int taken = -1;
 	int correct = -1;
 	int resolved = -1;
 	
+	int traceDone = 0; // Fetch has nothing left to read
 	int totalMarked = 0; // This is used by the dispatch queue functions
-	dispatch_node *dispatch_head;
-	schedule_node *schedule_head;
+	int dispatch_size;
+	int schedule_size;
 	
 	
     while (1) { 
@@ -113,11 +388,11 @@ int main(int argc, char* argv[]) {
 		 * are done processing. If all queues are empty, we don't have to keep going
 		 */
 		////////////////////////////////////////////////////////////////////////
-		int isStateArrayEmpty = stateEmpty();
-		dispatch_head = getDispHead();
-		schedule_head = getScheduleHead();
-		if((fetchQueue[0] == NULL) && (dispatch_head == NULL) && (schedule_head == NULL) && 
-			(clock > 1) && (isStateArrayEmpty == 1)) {
+		int isStateArrayEmpty = stateEmpty(sim);
+		dispatch_size = getDispSize(sim);
+		schedule_size = getScheduleSize(sim);
+		if((fetchQueue[0] == NULL) && (dispatch_size == 0) && (schedule_size == 0) && 
+			(clock > 1) && (isStateArrayEmpty == 1) && speculationEmpty(sim)) {
 			goto finish;
 		}
 	
@@ -126,64 +401,97 @@ int main(int argc, char* argv[]) {
 		 * First move everything from one stage to another
 		 */
 		////////////////////////////////////////////////////////////////////////
-		sendToFinal(); // State update to Final Queue
-		sendToSU(clock); // Exec to State Update
-		resolveBranches(); // Check the instructions that were just moved and resolve in tag order
-		moveToExecute(clock); // Scheduling Queue to Execute
-		dispatchToSchedule(clock, totalMarked); // Dispatch Queue to Schedule Queue
-		dispatch_Enqueue(fetchQueue, clock); // Fetch Queue to Dispatch Queue
-		// Then file trace to fetch queue
-        for(int i = 0; i < f; i++) {
-			if(!feof(fin)) {
-				char a[50];
-				int b[50];
-				int j = 0;
-				fgets(a, sizeof(a), fin);
-				char *p = strtok(a, " ");
-				int ret = 0;
-				while(p != NULL)  {
-					ret++;
-					int d;
-					if(ret == 1 || ret == 6) {
-						d = strtol(p, NULL, 16);
-					} else {
-						d = atoi(p);
-					}
-					b[j++] = d;
-					p = strtok(NULL," ");
+		if(sendToFinal(sim) != 0) { // State update to Final Queue
+			fprintf(stderr, "Could not allocate the reorder window\n");
+			free(fetchQueue);
+			return -1;
+		}
+		sendToSU(sim, clock); // Exec to State Update
+		// Check the instructions that were just moved and resolve in tag order. 
+		// A squash (only with a ROB) takes the fetch queue and whatever dispatch 
+		// marked last cycle with it
+		int numSquashes = resolveBranches(sim, clock, fetchQueue);
+		if(numSquashes < 0) {
+			fprintf(stderr, "Could not allocate the replay queue\n");
+			free(fetchQueue);
+			return -1;
+		}
+		if(numSquashes > 0) {
+			totalMarked = 0;
+			fetchQueueTail = NULL;
+			fetchCount = 0;
+		}
+		moveToExecute(sim, clock); // Scheduling Queue to Execute
+		dispatchToSchedule(sim, clock, totalMarked); // Dispatch Queue to Schedule Queue
+		fetchCount -= dispatch_Enqueue(sim, fetchQueue, clock); // Fetch Queue to Dispatch Queue
+		// Then file trace to fetch queue, as long as the fetch queue has room. 
+		// If it doesn't the trace just waits until it does. Squashed 
+		// instructions get fetched again before anything new, but not until 
+		// the mispredict penalty (or an I-cache miss) is over
+		int fetchWidth = (clock < sim->fetch_resume) ? 0 : f;
+		int numFetched = 0;
+        for(int i = 0; i < fetchWidth && (fetchLimit == 0 || fetchCount < fetchLimit); i++) {
+			instr *tempInstr = replayNext(sim);
+			if(tempInstr != NULL) {
+				tempInstr->fetch = clock;
+			} else {
+				int ret = traceNext(reader, &rec);
+				if(ret == -1) {
+					traceDone = 1;
+					break; // Nothing left in the trace
 				}
-				
-				address = (uint64_t)b[0];
-				fu_type = b[1];
-				dest_reg = b[2];
-				src_1 = b[3];
-				src_2 = b[4];
-				
-				if(ret == 5) {
-					branch = 0;
-					taken  = -1;
-					correct = -1;
-					resolved = -1;
-				} else if(ret == 7) {
+				if(ret == -2) {
+					fprintf(stderr, "Could not read the trace after instruction %" PRId64 "\n", tag);
+					free(fetchQueue);
+					return -1;
+				}
+				if(ret == 0)
+					continue; // Line wasn't an instruction
+				if(!regInRange(rec.dest, numRegs) || !regInRange(rec.src1, numRegs) || 
+					!regInRange(rec.src2, numRegs)) {
+					fprintf(stderr, "Instruction %" PRId64 " uses a register outside of 0-%d\n", 
+						tag + 1, numRegs - 1);
+					free(fetchQueue);
+					return -1;
+				}
+			
+				if(rec.branch == 1) {
 					branch = 1;
-					taken = b[6];
+					taken = rec.taken;
 					correct = -1; // Will be determined when it goes to dispatch
 					resolved = 0; // Will be 0 since it's resolved later
 				} else {
-					continue;
+					branch = 0;
+					taken  = -1;
+					correct = -1;
+					resolved = -1;
 				}
-					
+				
 				// First create/pop ulate an instruction struct
-				instr *tempInstr = createInstruction(address, fu_type, dest_reg, 
-					src_1, src_2, -5, -5, tag, clock, branch, taken, correct, resolved);
-					
-				// then add the instruction to an 'instruction queue'. Just a 
-				// holding cell for instructions before the next cycle when 
-				// they can go to dispatch
-				fetchQueueTail = addToFetchQueue(fetchQueue, fetchQueueTail, tempInstr);
+				tempInstr = createInstruction(sim, rec.address, rec.fu, rec.dest, 
+					rec.src1, rec.src2, tag, clock, branch, taken, correct, resolved);
 				tag++;
-				
 			}
+			
+			// The I-cache or the end of the fetch block can keep it for later
+			fetch_result fetched = fetchInstr(sim, tempInstr, clock, numFetched);
+			if(fetched == FETCH_HOLD) {
+				if(fetchHold(sim, tempInstr) != 0) {
+					fprintf(stderr, "Could not allocate the replay queue\n");
+					free(fetchQueue);
+					return -1;
+				}
+				break;
+			}
+				
+			// then add the instruction to an 'instruction queue'. Just a 
+			// holding cell for instructions before the next cycle when 
+			// they can go to dispatch
+			fetchQueueTail = addToFetchQueue(sim, fetchQueue, fetchQueueTail, tempInstr);
+			fetchCount++;
+			numFetched++;
+			if(fetched == FETCH_LAST)
+				break;
 		}
 		
 		////////////////////////////////////////////////////////////////////////
@@ -191,19 +499,24 @@ int main(int argc, char* argv[]) {
 		 * Then just update our stats for the dispatch queue
 		 */ 
 		////////////////////////////////////////////////////////////////////////
-		updateDispatchQueueSize();
+		updateDispatchQueueSize(sim);
 		
 		////////////////////////////////////////////////////////////////////////
 		/*
 		 * Then we do what needs to happen during the clock cycle
 		 */
 		////////////////////////////////////////////////////////////////////////
-		writeToRegFile(); // Write whatever is in state update to register file
-		setToFired(); // Independent Instructions are marked to fire
-		totalMarked = reserveScheduleSpots(); // Dispatch queue reserve spots in scheduling queue
-		readUpdateRegFile(totalMarked); // Dispatch queue reads register file to instr that will be sent at start of next cycle
-		broadcastToSched(); // Update waiting schedule queue nodes via broadcast from state update
-		removeAllSUFromSched(); // State update deletes finished nodes from schedule queue
+		writeToRegFile(sim); // Write whatever is in state update to register file
+		setToFired(sim); // Independent Instructions are marked to fire
+		totalMarked = reserveScheduleSpots(sim); // Dispatch queue reserve spots in scheduling queue
+		// Dispatch queue reads register file to instr that will be sent at start of next cycle
+		if(readUpdateRegFile(sim, totalMarked) != 0) {
+			fprintf(stderr, "Could not allocate a wakeup list node\n");
+			free(fetchQueue);
+			return -1;
+		}
+		broadcastToSched(sim); // Update waiting schedule queue nodes via broadcast from state update
+		removeAllSUFromSched(sim); // State update deletes finished nodes from schedule queue
 		
 		
 		
@@ -213,26 +526,38 @@ int main(int argc, char* argv[]) {
 		 * to be moved at the start of the next cycle
 		 */
 		////////////////////////////////////////////////////////////////////////
-		setToChosen(); // Mark instructions in FUs as ready to move to SU
-		markForExecution(); // Mark instructions in scheduling queue to move to Exec
+		setToChosen(sim, clock); // Mark finished instructions in FUs as ready to move to SU
+		markForExecution(sim); // Mark instructions in scheduling queue to move to Exec
 		
 		// Lastly Update Clock
 		clock++;
+		
+		// If fetch can't do anything, skip ahead to the next cycle where the 
+		// rest of the pipeline can. Nothing changes in the cycles in between. 
+		// Fetch that's only waiting out a mispredict penalty wakes up by itself
+		int fetchWaiting = (traceDone == 0 || sim->replay.count > 0) && 
+			(fetchLimit == 0 || fetchCount < fetchLimit);
+		int fetchBlocked = (fetchWaiting == 0) || (clock < sim->fetch_resume);
+		if(fetchBlocked && (fetchQueue[0] == NULL || dispatchCanAccept(sim) == 0)) {
+			int64_t nextEvent = getNextEventCycle(sim, clock);
+			if(fetchWaiting && sim->fetch_resume < nextEvent)
+				nextEvent = sim->fetch_resume;
+			if(nextEvent != INT64_MAX && nextEvent > clock) {
+				skipIdleCycles(sim, nextEvent - clock);
+				clock = nextEvent;
+			}
+		}
     }
-    finish: fclose(fin);
-	printFinalQueue();
-	freeFinalQueue();
-	printf("\n");
-	printStats();
-	
-    return 0;
+    finish: printFinalQueue(sim);
+	free(fetchQueue);
+	return 0;
 }
-
-instr *createInstruction(uint64_t address, int fu, int dest, int src1, int src2, 
-	int src1_tag, int src2_tag, int tag, int clock, int branch, int taken, int correct, 
+instr *createInstruction(proc_sim *sim, uint64_t address, int fu, int dest, int src1, int src2, 
+	int64_t tag, int64_t clock, int branch, int taken, int correct, 
 	int resolved) {
 	
-	instr *tempInstr = malloc(sizeof(instr)*1);
+	// The source tags and ready bits start out reset in the in-flight table
+	instr *tempInstr = instrAlloc(sim);
 	if(tempInstr == NULL) 
 		return NULL;
 	tempInstr->address = address;
@@ -241,12 +566,7 @@ instr *createInstruction(uint64_t address, int fu, int dest, int src1, int src2,
 	tempInstr->dest_tag = tag;
 	
 	tempInstr->source1 = src1;
-	tempInstr->source1_tag = src1_tag; // -5 is just a placeholder
-	tempInstr->source1_ready = 0; // We'll find out when dispatch reads from reg file
-	
 	tempInstr->source2 = src2;
-	tempInstr->source2_tag = src2_tag; // -5 is just a placeholder
-	tempInstr->source2_ready = 0; // We'll find out when dispatch reads from reg file
 	
 	tempInstr->branch = branch;
 	tempInstr->taken = taken;
@@ -264,8 +584,8 @@ instr *createInstruction(uint64_t address, int fu, int dest, int src1, int src2,
 	return tempInstr;
 }
 
-if_listnode *addToFetchQueue(if_listnode **fetchQueue, if_listnode *fetchQueueTail, instr *currInstr) {
-	if_listnode *newNode = malloc(sizeof(if_listnode)*1);
+if_listnode *addToFetchQueue(proc_sim *sim, if_listnode **fetchQueue, if_listnode *fetchQueueTail, instr *currInstr) {
+	if_listnode *newNode = (if_listnode *)poolAlloc(&sim->fetch_pool);
 	if(newNode == NULL)
 		return NULL;
 	
@@ -282,18 +602,66 @@ if_listnode *addToFetchQueue(if_listnode **fetchQueue, if_listnode *fetchQueueTa
 	
 }
 
-void printStats() {
-	stats *myStats = getStats();
+void printStats(proc_sim *sim) {
+	stats *myStats = getStats(sim);
 	//printf("%f\n", myStats->avgInstRet); -- For experiments
 	//printf("%f\n", myStats->predictionAcc); -- For experiments
  	printf("Processor stats:\n");
-	printf("Total branch instructions: %lu\n", myStats->totalBranchInstr);
-	printf("Total correct predicted branch instructions: %lu\n", myStats->totalCorrectBranch);
+	printf("Total branch instructions: %" PRId64 "\n", myStats->totalBranchInstr);
+	printf("Total correct predicted branch instructions: %" PRId64 "\n", myStats->totalCorrectBranch);
 	printf("prediction accuracy: %f\n", myStats->predictionAcc);
+	if(sim->curr_Config.icache.size_kb > 0) {
+		printf("I-cache accesses: %" PRId64 "\n", myStats->icacheAccesses);
+		printf("I-cache hits: %" PRId64 "\n", myStats->icacheHits);
+		printf("I-cache hit rate: %f\n", myStats->icacheHitRate);
+	}
+	if(sim->curr_Config.sched_distributed || sim->curr_Config.sched_size[0] > 0) {
+		for(int c = 0; c < SCHED_FU_CLASSES; c++)
+			printf("Avg k%d scheduling entries: %f (max %" PRId64 ")\n", c, myStats->avgSchedOccupancy[c], 
+				myStats->maxSchedOccupancy[c]);
+	}
 	printf("Avg Dispatch queue size: %f\n", myStats->avgDispQueue);
-	printf("Maximum Dispatch queue size: %lu\n", myStats->maxDispQueue);
+	printf("Maximum Dispatch queue size: %" PRId64 "\n", myStats->maxDispQueue);
 	printf("Avg inst Issue per cycle: %f\n", myStats->avgInstIssue);
 	printf("Avg inst retired per cycle: %f\n", myStats->avgInstRet);
-	printf("Total run time (cycles): %lu\n", myStats->totalRuntime); 
-	free(myStats);
+	printf("Total run time (cycles): %" PRId64 "\n", myStats->totalRuntime); 
+}
+
+/*
+ * -S is either one number (the size of the unified scheduling queue), 
+ * "distributed" for per-class reservation stations of the usual 2 per FU, or 
+ * J,K,L to size each station. Returns -1 if it's none of those
+ */
+int parseScheduler(const char *arg, int *distributed, int *sizes) {
+	if(strcmp(arg, "distributed") == 0) {
+		*distributed = 1;
+		return 0;
+	}
+	
+	int numSizes = 0;
+	const char *c = arg;
+	while(numSizes < SCHED_FU_CLASSES) {
+		char *end;
+		long size = strtol(c, &end, 10);
+		if(end == c || size <= 0)
+			return -1;
+		sizes[numSizes++] = (int)size;
+		if(*end == '\0')
+			break;
+		// Anything after the last size (like a fourth one) is an error too
+		if(*end != ',' || numSizes == SCHED_FU_CLASSES)
+			return -1;
+		c = end + 1;
+	}
+	
+	if(numSizes == 1) {
+		*distributed = 0;
+		return 0;
+	}
+	*distributed = 1;
+	return (numSizes == SCHED_FU_CLASSES) ? 0 : -1;
+}
+
+int regInRange(int reg, int numRegs) {
+	return reg >= -1 && reg < numRegs;
 }
\ No newline at end of file
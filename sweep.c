@@ -0,0 +1,666 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "sweep.h"
+
+/*
+ * Sweep files have one line per group of configurations with the fields 
+ * 'R F J K L'. Each field is a comma separated list of values or inclusive 
+ * ranges, and every combination on the line gets simulated, so
+ *
+ *     1-4 4 1,3 2 1
+ *
+ * is 8 configurations. Anything after a '#' is a comment
+ */
+#define SWEEP_FIELDS 5
+#define SWEEP_MAX_VALUES 256
+
+/**
+ * The state shared by the worker threads. Workers just grab the next point 
+ * that nobody has simulated yet until they run out
+ */
+typedef struct sweep_work_t {
+	sweep_point *points;
+	int numPoints;
+	int nextPoint;
+	pthread_mutex_t lock;
+	const trace_reader *trace;
+} sweep_work;
+
+/*
+ * Predictor sweep files have the fields 'PREDICTORS T H', where PREDICTORS is 
+ * a comma separated list of predictor names and T and H are lists of table 
+ * bits and history bits like above. Branches are run through a batch of 
+ * predictors a block at a time, so the block of branches stays in cache while 
+ * every predictor in the batch goes over it
+ */
+#define PRED_FIELDS 3
+#define PRED_BATCH 8
+#define PRED_BLOCK 4096
+
+/**
+ * Just the branches of the trace, pulled out once and shared by the workers
+ */
+typedef struct branch_stream_t {
+	uint64_t *address;
+	uint8_t *taken;
+	int64_t count;
+} branch_stream;
+
+typedef struct pred_work_t {
+	pred_point *points;
+	int numPoints;
+	int nextPoint;
+	pthread_mutex_t lock;
+	const branch_stream *branches;
+} pred_work;
+
+/*
+ * Function headers I need
+ */
+int parseSweepField(char *field, int *values);
+int parseSweepFile(const char *sweepFile, const config *base, sweep_point **points);
+void *sweepWorker(void *arg);
+void writeSweepCSV(FILE *out, sweep_point *points, int numPoints);
+void writeSweepJSON(FILE *out, sweep_point *points, int numPoints);
+int defaultThreadCount();
+int runWorkers(void *(*worker)(void *), void *work, int numThreads);
+FILE *openSweepOutput(const char *outFile, int *json);
+int parsePredictorFile(const char *predFile, pred_point **points);
+int loadBranchStream(trace_reader *trace, branch_stream *branches);
+void *predictorWorker(void *arg);
+void writePredictorCSV(FILE *out, pred_point *points, int numPoints);
+void writePredictorJSON(FILE *out, pred_point *points, int numPoints);
+
+/*
+ * Expand one field of a sweep line (e.g. '1-3,8') into its values. Returns the 
+ * number of values or -1 if the field doesn't make sense
+ */
+int parseSweepField(char *field, int *values) {
+	int count = 0;
+	char *save;
+	char *p = strtok_r(field, ",", &save);
+	while(p != NULL) {
+		int low;
+		int high;
+		char *dash = strchr(p + 1, '-');
+		low = atoi(p);
+		high = (dash != NULL) ? atoi(dash + 1) : low;
+		if(low <= 0 || high < low)
+			return -1;
+		for(int v = low; v <= high; v++) {
+			if(count == SWEEP_MAX_VALUES)
+				return -1;
+			values[count++] = v;
+		}
+		p = strtok_r(NULL, ",", &save);
+	}
+	return count;
+}
+
+/*
+ * Read the sweep file and expand it into the list of points to simulate. 
+ * Returns the number of points or -1 on a bad file
+ */
+int parseSweepFile(const char *sweepFile, const config *base, sweep_point **points) {
+	FILE *fin = fopen(sweepFile, "r");
+	if(fin == NULL)
+		return -1;
+	
+	int numPoints = 0;
+	int capacity = 64;
+	*points = (sweep_point *)malloc(sizeof(sweep_point) * capacity);
+	if(*points == NULL) {
+		fclose(fin);
+		return -1;
+	}
+	
+	char line[512];
+	int lineNum = 0;
+	while(fgets(line, sizeof(line), fin) != NULL) {
+		lineNum++;
+		char *comment = strchr(line, '#');
+		if(comment != NULL)
+			*comment = '\0';
+		
+		// Split the line into its fields
+		char *fields[SWEEP_FIELDS];
+		int numFields = 0;
+		char *save;
+		char *p = strtok_r(line, " \t\r\n", &save);
+		while(p != NULL && numFields < SWEEP_FIELDS) {
+			fields[numFields++] = p;
+			p = strtok_r(NULL, " \t\r\n", &save);
+		}
+		if(numFields == 0)
+			continue; // Blank line
+		
+		int values[SWEEP_FIELDS][SWEEP_MAX_VALUES];
+		int counts[SWEEP_FIELDS];
+		int ok = (numFields == SWEEP_FIELDS) && (p == NULL);
+		for(int i = 0; ok && i < SWEEP_FIELDS; i++) {
+			counts[i] = parseSweepField(fields[i], values[i]);
+			ok = (counts[i] > 0);
+		}
+		if(!ok) {
+			fprintf(stderr, "%s:%d: expected 'R F J K L'\n", sweepFile, lineNum);
+			free(*points);
+			fclose(fin);
+			return -1;
+		}
+		
+		// Then add every combination of the values on this line
+		int idx[SWEEP_FIELDS] = {0};
+		while(1) {
+			if(numPoints == capacity) {
+				capacity *= 2;
+				sweep_point *bigger = (sweep_point *)realloc(*points, sizeof(sweep_point) * capacity);
+				if(bigger == NULL) {
+					free(*points);
+					fclose(fin);
+					return -1;
+				}
+				*points = bigger;
+			}
+			sweep_point *point = &(*points)[numPoints++];
+			memset(point, 0, sizeof(sweep_point));
+			point->settings = *base; // Anything the sweep file doesn't set
+			point->settings.num_r_bus = values[0][idx[0]];
+			point->settings.fetch_rate = values[1][idx[1]];
+			point->settings.k0_size = values[2][idx[2]];
+			point->settings.k1_size = values[3][idx[3]];
+			point->settings.k2_size = values[4][idx[4]];
+			point->settings.stats_only = 1; // Only the stats go in the table
+			
+			// Move on to the next combination, odometer style
+			int field = SWEEP_FIELDS - 1;
+			while(field >= 0 && ++idx[field] == counts[field]) {
+				idx[field] = 0;
+				field--;
+			}
+			if(field < 0)
+				break;
+		}
+	}
+	fclose(fin);
+	return numPoints;
+}
+
+/*
+ * Worker thread. Each point gets its own simulator context and its own cursor 
+ * into the shared trace, so nothing but the work counter is shared
+ */
+void *sweepWorker(void *arg) {
+	sweep_work *work = (sweep_work *)arg;
+	
+	while(1) {
+		pthread_mutex_lock(&work->lock);
+		int index = work->nextPoint++;
+		pthread_mutex_unlock(&work->lock);
+		if(index >= work->numPoints)
+			break;
+		
+		sweep_point *point = &work->points[index];
+		proc_sim sim;
+		if(proc_init(&sim, &point->settings) != 0) {
+			proc_free(&sim);
+			point->failed = 1;
+			continue;
+		}
+		trace_reader cursor;
+		traceShare(&cursor, work->trace);
+		if(runSimulation(&sim, &cursor) != 0)
+			point->failed = 1;
+		else
+			point->results = *getStats(&sim);
+		proc_free(&sim);
+	}
+	return NULL;
+}
+
+/*
+ * Write the results as CSV. The columns are the same stats printStats() prints, 
+ * plus how many cycles dispatch spent stalled on mispredictions and the average 
+ * scheduling queue entries of each fu class. The I-cache hit rate is left 
+ * empty without an I-cache
+ */
+void writeSweepCSV(FILE *out, sweep_point *points, int numPoints) {
+	fprintf(out, "R,F,J,K,L,total_branch_instr,total_correct_branch,prediction_acc,"
+		"avg_disp_queue,max_disp_queue,avg_inst_issue,avg_inst_ret,total_runtime,stall_cycles,"
+		"avg_sched_k0,avg_sched_k1,avg_sched_k2,icache_hit_rate\n");
+	for(int i = 0; i < numPoints; i++) {
+		config *c = &points[i].settings;
+		stats *s = &points[i].results;
+		fprintf(out, "%d,%d,%d,%d,%d,", c->num_r_bus, c->fetch_rate, c->k0_size, 
+			c->k1_size, c->k2_size);
+		if(points[i].failed) {
+			fprintf(out, ",,,,,,,,,,,,\n");
+			continue;
+		}
+		fprintf(out, "%" PRId64 ",%" PRId64 ",%f,%f,%" PRId64 ",%f,%f,%" PRId64 ",%" PRId64 ",", s->totalBranchInstr, 
+			s->totalCorrectBranch, s->predictionAcc, s->avgDispQueue, s->maxDispQueue, 
+			s->avgInstIssue, s->avgInstRet, s->totalRuntime, s->stallCycles);
+		fprintf(out, "%f,%f,%f,", s->avgSchedOccupancy[0], s->avgSchedOccupancy[1], 
+			s->avgSchedOccupancy[2]);
+		if(c->icache.size_kb > 0)
+			fprintf(out, "%f", s->icacheHitRate);
+		fprintf(out, "\n");
+	}
+}
+
+/*
+ * Write the results as a JSON array with one object per configuration. JSON 
+ * has no NaN, so a trace without branches gets a null prediction accuracy
+ */
+void writeSweepJSON(FILE *out, sweep_point *points, int numPoints) {
+	fprintf(out, "[\n");
+	for(int i = 0; i < numPoints; i++) {
+		config *c = &points[i].settings;
+		stats *s = &points[i].results;
+		fprintf(out, "  {\"R\": %d, \"F\": %d, \"J\": %d, \"K\": %d, \"L\": %d", 
+			c->num_r_bus, c->fetch_rate, c->k0_size, c->k1_size, c->k2_size);
+		if(points[i].failed) {
+			fprintf(out, ", \"failed\": true");
+		} else {
+			fprintf(out, ", \"total_branch_instr\": %" PRId64 ", \"total_correct_branch\": %" PRId64, 
+				s->totalBranchInstr, s->totalCorrectBranch);
+			if(s->predictionAcc == s->predictionAcc)
+				fprintf(out, ", \"prediction_acc\": %f", s->predictionAcc);
+			else
+				fprintf(out, ", \"prediction_acc\": null");
+			fprintf(out, ", \"avg_disp_queue\": %f, \"max_disp_queue\": %" PRId64, 
+				s->avgDispQueue, s->maxDispQueue);
+			fprintf(out, ", \"avg_inst_issue\": %f, \"avg_inst_ret\": %f, \"total_runtime\": %" PRId64, 
+				s->avgInstIssue, s->avgInstRet, s->totalRuntime);
+			fprintf(out, ", \"stall_cycles\": %" PRId64, s->stallCycles);
+			fprintf(out, ", \"avg_sched\": [%f, %f, %f]", s->avgSchedOccupancy[0], 
+				s->avgSchedOccupancy[1], s->avgSchedOccupancy[2]);
+			if(c->icache.size_kb > 0)
+				fprintf(out, ", \"icache_hit_rate\": %f", s->icacheHitRate);
+		}
+		fprintf(out, "}%s\n", (i + 1 < numPoints) ? "," : "");
+	}
+	fprintf(out, "]\n");
+}
+
+/*
+ * One worker per online core
+ */
+int defaultThreadCount() {
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return (cores > 0) ? (int)cores : 1;
+}
+
+/*
+ * Simulate every point in the sweep file on a pool of worker threads and then 
+ * write out the table of results
+ */
+int runSweep(const char *sweepFile, const config *base, trace_reader *trace, int numThreads, const char *outFile) {
+	sweep_point *points;
+	int numPoints = parseSweepFile(sweepFile, base, &points);
+	if(numPoints < 0) {
+		fprintf(stderr, "Could not read sweep file %s\n", sweepFile);
+		return -1;
+	}
+	
+	// Decode the trace once. Every worker reads the same records
+	if(traceLoadAll(trace) != 0) {
+		fprintf(stderr, "Could not load the trace\n");
+		free(points);
+		return -1;
+	}
+	
+	if(numThreads <= 0)
+		numThreads = defaultThreadCount();
+	if(numThreads > numPoints)
+		numThreads = (numPoints > 0) ? numPoints : 1;
+	
+	sweep_work work;
+	work.points = points;
+	work.numPoints = numPoints;
+	work.nextPoint = 0;
+	work.trace = trace;
+	pthread_mutex_init(&work.lock, NULL);
+	
+	int ret = runWorkers(sweepWorker, &work, numThreads);
+	pthread_mutex_destroy(&work.lock);
+	if(ret != 0) {
+		free(points);
+		return -1;
+	}
+	
+	// Write the table in the same order as the sweep file
+	int json;
+	FILE *out = openSweepOutput(outFile, &json);
+	if(out == NULL) {
+		free(points);
+		return -1;
+	}
+	if(json)
+		writeSweepJSON(out, points, numPoints);
+	else
+		writeSweepCSV(out, points, numPoints);
+	if(out != stdout)
+		fclose(out);
+	
+	free(points);
+	return 0;
+}
+
+/*
+ * Helper function that runs worker on numThreads threads and waits for them 
+ * all. If no threads can be started it just runs the worker here
+ */
+int runWorkers(void *(*worker)(void *), void *work, int numThreads) {
+	pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * numThreads);
+	if(threads == NULL)
+		return -1;
+	int started = 0;
+	for(int i = 0; i < numThreads; i++) {
+		if(pthread_create(&threads[i], NULL, worker, work) != 0)
+			break;
+		started++;
+	}
+	if(started == 0)
+		worker(work); // Couldn't get any threads, so just do it here
+	for(int i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	return 0;
+}
+
+/*
+ * Helper function that opens where the results go (stdout if outFile is NULL) 
+ * and says whether they should be JSON
+ */
+FILE *openSweepOutput(const char *outFile, int *json) {
+	*json = 0;
+	if(outFile == NULL)
+		return stdout;
+	FILE *out = fopen(outFile, "w");
+	if(out == NULL) {
+		fprintf(stderr, "Could not open %s\n", outFile);
+		return NULL;
+	}
+	size_t nameLen = strlen(outFile);
+	*json = (nameLen >= 5 && strcmp(outFile + nameLen - 5, ".json") == 0);
+	return out;
+}
+
+/*
+ * Read a predictor sweep file and expand it into the list of predictors to 
+ * run. Returns the number of points or -1 on a bad file
+ */
+int parsePredictorFile(const char *predFile, pred_point **points) {
+	FILE *fin = fopen(predFile, "r");
+	if(fin == NULL)
+		return -1;
+	
+	int numPoints = 0;
+	int capacity = 64;
+	*points = (pred_point *)malloc(sizeof(pred_point) * capacity);
+	if(*points == NULL) {
+		fclose(fin);
+		return -1;
+	}
+	
+	char line[512];
+	int lineNum = 0;
+	while(fgets(line, sizeof(line), fin) != NULL) {
+		lineNum++;
+		char *comment = strchr(line, '#');
+		if(comment != NULL)
+			*comment = '\0';
+		
+		char *fields[PRED_FIELDS];
+		int numFields = 0;
+		char *save;
+		char *p = strtok_r(line, " \t\r\n", &save);
+		while(p != NULL && numFields < PRED_FIELDS) {
+			fields[numFields++] = p;
+			p = strtok_r(NULL, " \t\r\n", &save);
+		}
+		if(numFields == 0)
+			continue; // Blank line
+		
+		// First the predictor names, then the sizes
+		predictor_type types[PRED_TAGE + 1];
+		int numTypes = 0;
+		int tableBits[SWEEP_MAX_VALUES];
+		int historyBits[SWEEP_MAX_VALUES];
+		int numTable = -1;
+		int numHistory = -1;
+		int ok = (numFields == PRED_FIELDS) && (p == NULL);
+		if(ok) {
+			char *name = strtok_r(fields[0], ",", &save);
+			while(ok && name != NULL) {
+				ok = (numTypes <= PRED_TAGE) && (predictorParseType(name, &types[numTypes++]) == 0);
+				name = strtok_r(NULL, ",", &save);
+			}
+			numTable = parseSweepField(fields[1], tableBits);
+			numHistory = parseSweepField(fields[2], historyBits);
+		}
+		if(!ok || numTypes == 0 || numTable <= 0 || numHistory <= 0) {
+			fprintf(stderr, "%s:%d: expected 'PREDICTORS T H'\n", predFile, lineNum);
+			free(*points);
+			fclose(fin);
+			return -1;
+		}
+		
+		for(int t = 0; t < numTypes; t++) {
+			for(int i = 0; i < numTable; i++) {
+				for(int j = 0; j < numHistory; j++) {
+					if(numPoints == capacity) {
+						capacity *= 2;
+						pred_point *bigger = (pred_point *)realloc(*points, sizeof(pred_point) * capacity);
+						if(bigger == NULL) {
+							free(*points);
+							fclose(fin);
+							return -1;
+						}
+						*points = bigger;
+					}
+					pred_point *point = &(*points)[numPoints++];
+					memset(point, 0, sizeof(pred_point));
+					point->settings.type = types[t];
+					point->settings.table_bits = tableBits[i];
+					point->settings.history_bits = historyBits[j];
+				}
+			}
+		}
+	}
+	fclose(fin);
+	return numPoints;
+}
+
+/*
+ * Helper function that pulls just the branches out of the trace
+ */
+int loadBranchStream(trace_reader *trace, branch_stream *branches) {
+	int64_t capacity = 1024;
+	branches->count = 0;
+	branches->address = (uint64_t *)malloc(sizeof(uint64_t) * capacity);
+	branches->taken = (uint8_t *)malloc(capacity);
+	if(branches->address == NULL || branches->taken == NULL)
+		return -1;
+	
+	trace_record rec;
+	int ret;
+	while((ret = traceNext(trace, &rec)) >= 0) {
+		if(ret == 0 || rec.branch != 1)
+			continue;
+		if(branches->count == capacity) {
+			capacity *= 2;
+			uint64_t *address = (uint64_t *)realloc(branches->address, sizeof(uint64_t) * capacity);
+			if(address == NULL)
+				return -1;
+			branches->address = address;
+			uint8_t *taken = (uint8_t *)realloc(branches->taken, capacity);
+			if(taken == NULL)
+				return -1;
+			branches->taken = taken;
+		}
+		branches->address[branches->count] = rec.address;
+		branches->taken[branches->count] = (uint8_t)rec.taken;
+		branches->count++;
+	}
+	return (ret == -2) ? -1 : 0;
+}
+
+/*
+ * Worker thread for a predictor sweep. It takes a batch of predictors at a 
+ * time and runs them over the branches one block at a time
+ */
+void *predictorWorker(void *arg) {
+	pred_work *work = (pred_work *)arg;
+	const branch_stream *branches = work->branches;
+	branch_predictor batch[PRED_BATCH];
+	pred_point *batchPoints[PRED_BATCH];
+	
+	while(1) {
+		pthread_mutex_lock(&work->lock);
+		int first = work->nextPoint;
+		int numBatch = work->numPoints - first;
+		if(numBatch > PRED_BATCH)
+			numBatch = PRED_BATCH;
+		if(numBatch < 0)
+			numBatch = 0;
+		work->nextPoint += numBatch;
+		pthread_mutex_unlock(&work->lock);
+		if(numBatch == 0)
+			break;
+		
+		// Set up the batch, leaving out anything that can't be built
+		int numReady = 0;
+		for(int i = 0; i < numBatch; i++) {
+			pred_point *point = &work->points[first + i];
+			if(predictorInit(&batch[numReady], &point->settings) != 0) {
+				predictorFree(&batch[numReady]);
+				point->failed = 1;
+				continue;
+			}
+			batchPoints[numReady++] = point;
+		}
+		
+		int64_t correct[PRED_BATCH] = {0};
+		for(int64_t start = 0; start < branches->count; start += PRED_BLOCK) {
+			int64_t end = start + PRED_BLOCK;
+			if(end > branches->count)
+				end = branches->count;
+			for(int i = 0; i < numReady; i++) {
+				branch_predictor *bp = &batch[i];
+				int64_t right = 0;
+				for(int64_t b = start; b < end; b++)
+					right += predictorStep(bp, branches->address[b], branches->taken[b]);
+				correct[i] += right;
+			}
+		}
+		
+		for(int i = 0; i < numReady; i++) {
+			batchPoints[i]->settings = batch[i].settings; // With the defaults filled in
+			batchPoints[i]->totalBranchInstr = branches->count;
+			batchPoints[i]->totalCorrectBranch = correct[i];
+			predictorFree(&batch[i]);
+		}
+	}
+	return NULL;
+}
+
+void writePredictorCSV(FILE *out, pred_point *points, int numPoints) {
+	fprintf(out, "predictor,table_bits,history_bits,total_branch_instr,total_correct_branch,prediction_acc\n");
+	for(int i = 0; i < numPoints; i++) {
+		pred_point *p = &points[i];
+		fprintf(out, "%s,%d,%d,", predictorName(p->settings.type), p->settings.table_bits, 
+			p->settings.history_bits);
+		if(p->failed) {
+			fprintf(out, ",,\n");
+			continue;
+		}
+		fprintf(out, "%" PRId64 ",%" PRId64 ",%f\n", p->totalBranchInstr, p->totalCorrectBranch, 
+			((float)p->totalCorrectBranch)/((float)p->totalBranchInstr));
+	}
+}
+
+void writePredictorJSON(FILE *out, pred_point *points, int numPoints) {
+	fprintf(out, "[\n");
+	for(int i = 0; i < numPoints; i++) {
+		pred_point *p = &points[i];
+		fprintf(out, "  {\"predictor\": \"%s\", \"table_bits\": %d, \"history_bits\": %d", 
+			predictorName(p->settings.type), p->settings.table_bits, p->settings.history_bits);
+		if(p->failed) {
+			fprintf(out, ", \"failed\": true");
+		} else {
+			fprintf(out, ", \"total_branch_instr\": %" PRId64 ", \"total_correct_branch\": %" PRId64, 
+				p->totalBranchInstr, p->totalCorrectBranch);
+			if(p->totalBranchInstr > 0)
+				fprintf(out, ", \"prediction_acc\": %f", ((float)p->totalCorrectBranch)/((float)p->totalBranchInstr));
+			else
+				fprintf(out, ", \"prediction_acc\": null");
+		}
+		fprintf(out, "}%s\n", (i + 1 < numPoints) ? "," : "");
+	}
+	fprintf(out, "]\n");
+}
+
+/*
+ * Run every predictor in the predictor sweep file over just the branches of 
+ * the trace and write out the accuracy of each one
+ */
+int runPredictorSweep(const char *predFile, trace_reader *trace, int numThreads, const char *outFile) {
+	pred_point *points;
+	int numPoints = parsePredictorFile(predFile, &points);
+	if(numPoints < 0) {
+		fprintf(stderr, "Could not read predictor sweep file %s\n", predFile);
+		return -1;
+	}
+	
+	branch_stream branches;
+	if(loadBranchStream(trace, &branches) != 0) {
+		fprintf(stderr, "Could not load the trace\n");
+		free(branches.address);
+		free(branches.taken);
+		free(points);
+		return -1;
+	}
+	
+	if(numThreads <= 0)
+		numThreads = defaultThreadCount();
+	int numBatches = (numPoints + PRED_BATCH - 1) / PRED_BATCH;
+	if(numThreads > numBatches)
+		numThreads = (numBatches > 0) ? numBatches : 1;
+	
+	pred_work work;
+	work.points = points;
+	work.numPoints = numPoints;
+	work.nextPoint = 0;
+	work.branches = &branches;
+	pthread_mutex_init(&work.lock, NULL);
+	int ret = runWorkers(predictorWorker, &work, numThreads);
+	pthread_mutex_destroy(&work.lock);
+	free(branches.address);
+	free(branches.taken);
+	if(ret != 0) {
+		free(points);
+		return -1;
+	}
+	
+	int json;
+	FILE *out = openSweepOutput(outFile, &json);
+	if(out == NULL) {
+		free(points);
+		return -1;
+	}
+	if(json)
+		writePredictorJSON(out, points, numPoints);
+	else
+		writePredictorCSV(out, points, numPoints);
+	if(out != stdout)
+		fclose(out);
+	
+	free(points);
+	return 0;
+}
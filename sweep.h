@@ -0,0 +1,44 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "procsim.h"
+#include "trace.h"
+
+/**
+ * One point of a design space sweep. The settings are filled in from the sweep 
+ * file and the results get filled in by whichever worker thread simulates it
+ */
+typedef struct sweep_point_t {
+	config settings;
+	stats results;
+	int failed; // The simulator couldn't be set up for this point
+} sweep_point;
+
+/*
+ * Runs every configuration listed in sweepFile over the same trace. Settings 
+ * the sweep file doesn't cover (like the FU latencies) are copied from base. The trace 
+ * is decoded into memory once and shared (read-only) by numThreads workers. 
+ * Results go to outFile as CSV, or JSON if the name ends in .json, or to stdout 
+ * as CSV if outFile is NULL
+ */
+int runSweep(const char *sweepFile, const config *base, trace_reader *trace, int numThreads, const char *outFile);
+
+/**
+ * One predictor configuration in a predictor-only sweep. These skip the whole 
+ * pipeline, so each branch gets predicted and then trained right away in 
+ * program order instead of being trained when it resolves
+ */
+typedef struct pred_point_t {
+	predictor_config settings;
+	int64_t totalBranchInstr;
+	int64_t totalCorrectBranch;
+	int failed; // The predictor couldn't be set up for this point
+} pred_point;
+
+/*
+ * Runs only the branches of the trace through every predictor configuration 
+ * listed in predFile ('PREDICTORS T H' per line). Output works like runSweep
+ */
+int runPredictorSweep(const char *predFile, trace_reader *trace, int numThreads, const char *outFile);
+
+#endif /* SWEEP_H */
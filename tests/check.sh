@@ -0,0 +1,45 @@
+#!/bin/bash
+# Runs every trace in tests/traces through every configuration in 
+# tests/configs.txt and compares the output against tests/golden. 
+# 
+# usage: tests/check.sh [procsim binary] [--update]
+# --update rewrites the golden files instead, for when the output is 
+# supposed to change
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+PROCSIM=${1:-$DIR/../procsim}
+UPDATE=0
+[ "$2" = "--update" ] && UPDATE=1
+
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+fail=0
+runs=0
+i=0
+while IFS= read -r config; do
+	# Skip comments and blank lines
+	case "$config" in
+		''|'#'*) continue ;;
+	esac
+	for trace in "$DIR"/traces/*.trace; do
+		name=$(basename "$trace" .trace).$i.out
+		$PROCSIM $config -i "$trace" > "$OUT/$name" 2>&1
+		if [ $UPDATE = 1 ]; then
+			cp "$OUT/$name" "$DIR/golden/$name"
+		elif ! cmp -s "$DIR/golden/$name" "$OUT/$name"; then
+			echo "FAIL $name ($config)"
+			diff "$DIR/golden/$name" "$OUT/$name" | head -10
+			fail=1
+		fi
+		runs=$((runs + 1))
+	done
+	i=$((i + 1))
+done < "$DIR/configs.txt"
+
+if [ $UPDATE = 1 ]; then
+	echo "Updated $runs golden files"
+elif [ $fail = 0 ]; then
+	echo "All $runs runs match"
+fi
+exit $fail
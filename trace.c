@@ -0,0 +1,334 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "trace.h"
+
+// Records the reader thread can get ahead of the simulation by. Has to be a 
+// power of 2
+#define TRACE_RING_SIZE 4096
+
+/**
+ * Single producer, single consumer ring between the reader thread and the 
+ * simulation. The thread only ever writes tail and the simulation only ever 
+ * writes head, so neither side needs a lock. They're on separate cache lines 
+ * so the two sides don't keep stealing the line from each other, and each 
+ * side keeps its own copy of the other's index and only rereads it when the 
+ * ring looks full (or empty)
+ */
+typedef struct trace_ring_t {
+	trace_record records[TRACE_RING_SIZE];
+	int8_t status[TRACE_RING_SIZE]; // What decoding the line returned (1 or 0)
+	pthread_t thread;
+	
+	uint64_t tail __attribute__((aligned(64))); // Next slot the thread fills
+	int done; // Set once the thread has pushed the last line
+	int error; // The thread stopped because the trace couldn't be read
+	uint64_t head_cache; // Thread's copy of head
+	
+	uint64_t head __attribute__((aligned(64))); // Next slot the simulation reads
+	uint64_t tail_cache; // Simulation's copy of tail
+	int stop; // traceClose wants the thread gone before the trace is
+} trace_ring;
+
+/*
+ * Function headers I need
+ */
+int traceDecodeNext(trace_reader *reader, trace_record *rec);
+void *traceReaderThread(void *arg);
+void traceStopReader(trace_reader *reader);
+
+/*
+ * Parse one line of a text trace into a record. The line is either 
+ * 'address fu dest src1 src2' or 'address fu dest src1 src2 target taken' for 
+ * branches, with the addresses in hex. Returns 1 if the line was an instruction. 
+ * Otherwise it returns 0 and rec gets the placeholder for the line
+ */
+int parseTraceLine(char *line, trace_record *rec) {
+	int b[7];
+	uint64_t address = 0;
+	int ret = 0;
+	char *p = strtok(line, " ");
+	while(p != NULL) {
+		ret++;
+		// The addresses are full 64 bit PCs, so they can't go through an int. 
+		// Nothing uses the branch target
+		if(ret == 1) {
+			address = strtoull(p, NULL, 16);
+		} else if(ret <= 7 && ret != 6) {
+			b[ret - 1] = atoi(p);
+		}
+		p = strtok(NULL, " ");
+	}
+	
+	if(ret != 5 && ret != 7) {
+		memset(rec, 0, sizeof(trace_record));
+		rec->branch = TRACE_NOT_INSTR;
+		return 0;
+	}
+	
+	rec->address = address;
+	rec->fu = b[1];
+	rec->dest = b[2];
+	rec->src1 = b[3];
+	rec->src2 = b[4];
+	rec->pad = 0;
+	if(ret == 7) {
+		rec->branch = 1;
+		rec->taken = b[6];
+	} else {
+		rec->branch = 0;
+		rec->taken = -1;
+	}
+	return 1;
+}
+
+/*
+ * Set up a reader for a text trace that's already open
+ */
+int traceOpenText(trace_reader *reader, FILE *fin) {
+	memset(reader, 0, sizeof(trace_reader));
+	reader->fin = fin;
+	return (fin == NULL) ? -1 : 0;
+}
+
+/*
+ * Map a binary trace into memory and check that its header makes sense
+ */
+int traceOpenBinary(trace_reader *reader, const char *fileName) {
+	memset(reader, 0, sizeof(trace_reader));
+	
+	int fd = open(fileName, O_RDONLY);
+	if(fd < 0)
+		return -1;
+	
+	struct stat st;
+	if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(trace_header)) {
+		close(fd);
+		return -1;
+	}
+	
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // The mapping stays valid without the descriptor
+	if(map == MAP_FAILED)
+		return -1;
+	
+	const trace_header *header = (const trace_header *)map;
+	if(memcmp(header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 || 
+		header->version != TRACE_VERSION || header->record_size != sizeof(trace_record) ||
+		header->num_records > (st.st_size - sizeof(trace_header)) / sizeof(trace_record)) {
+		munmap(map, st.st_size);
+		return -1;
+	}
+	posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+	
+	reader->records = (const trace_record *)((const char *)map + sizeof(trace_header));
+	reader->num_records = header->num_records;
+	reader->next_record = 0;
+	reader->map_size = st.st_size;
+	return 0;
+}
+
+/*
+ * Done with the trace
+ */
+void traceClose(trace_reader *reader) {
+	traceStopReader(reader);
+	if(reader->map_size > 0) {
+		munmap((char *)reader->records - sizeof(trace_header), reader->map_size);
+		reader->map_size = 0;
+	} else if(reader->owns_records) {
+		free((trace_record *)reader->records);
+		reader->owns_records = 0;
+	}
+	reader->records = NULL;
+	if(reader->fin != NULL) {
+		fclose(reader->fin);
+		reader->fin = NULL;
+	}
+	free(reader->line);
+	reader->line = NULL;
+	reader->line_size = 0;
+}
+
+/*
+ * Decode everything left in a text trace into one array so that it can be 
+ * shared by any number of simulations. Lines that aren't instructions stay in 
+ * as placeholders. Binary traces are already in memory so there's nothing to 
+ * do for those
+ */
+int traceLoadAll(trace_reader *reader) {
+	if(reader->records != NULL)
+		return 0;
+	
+	uint64_t capacity = 1024;
+	uint64_t count = 0;
+	trace_record *records = (trace_record *)malloc(sizeof(trace_record) * capacity);
+	if(records == NULL)
+		return -1;
+	
+	trace_record rec;
+	int ret;
+	while((ret = traceNext(reader, &rec)) >= 0) {
+		if(count == capacity) {
+			capacity *= 2;
+			trace_record *bigger = (trace_record *)realloc(records, sizeof(trace_record) * capacity);
+			if(bigger == NULL) {
+				free(records);
+				return -1;
+			}
+			records = bigger;
+		}
+		records[count++] = rec;
+	}
+	if(ret == -2) {
+		free(records);
+		return -1;
+	}
+	
+	traceStopReader(reader); // The thread already finished, just get rid of it
+	fclose(reader->fin);
+	reader->fin = NULL;
+	reader->records = records;
+	reader->num_records = count;
+	reader->next_record = 0;
+	reader->owns_records = 1;
+	return 0;
+}
+
+/*
+ * Make a new cursor that starts at the beginning of an in-memory trace. The 
+ * cursor doesn't own anything, so closing it leaves the shared trace alone
+ */
+void traceShare(trace_reader *cursor, const trace_reader *shared) {
+	memset(cursor, 0, sizeof(trace_reader));
+	cursor->records = shared->records;
+	cursor->num_records = shared->num_records;
+	cursor->next_record = 0;
+}
+
+/*
+ * Get the next record from the trace. With a reader thread running it's 
+ * already been decoded and just has to come out of the ring
+ */
+int traceNext(trace_reader *reader, trace_record *rec) {
+	trace_ring *ring = reader->ring;
+	if(ring == NULL)
+		return traceDecodeNext(reader, rec);
+	
+	uint64_t head = ring->head;
+	while(head == ring->tail_cache) {
+		// Have to check done before tail, or the last few lines could get 
+		// pushed in between and missed
+		int done = __atomic_load_n(&ring->done, __ATOMIC_ACQUIRE);
+		ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		if(head != ring->tail_cache)
+			break;
+		if(done)
+			return ring->error ? -2 : -1;
+		sched_yield(); // The thread is behind, let it run
+	}
+	
+	uint64_t slot = head & (TRACE_RING_SIZE - 1);
+	*rec = ring->records[slot];
+	int ret = ring->status[slot];
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return ret;
+}
+
+/*
+ * Get the next record straight from the trace. Binary traces are just a copy 
+ * out of the mapping, text traces read and parse the next line. Lines are 
+ * read whole no matter how long they are, since 64 bit PCs and big register 
+ * numbers don't fit in any fixed size buffer we'd want to pick
+ */
+int traceDecodeNext(trace_reader *reader, trace_record *rec) {
+	if(reader->records != NULL) {
+		if(reader->next_record == reader->num_records)
+			return -1;
+		*rec = reader->records[reader->next_record++];
+		return (rec->branch == TRACE_NOT_INSTR) ? 0 : 1;
+	}
+	
+	if(feof(reader->fin))
+		return -1;
+	if(getline(&reader->line, &reader->line_size, reader->fin) < 0)
+		return feof(reader->fin) ? -1 : -2; // Otherwise it's a read error or out of memory
+	return parseTraceLine(reader->line, rec);
+}
+
+/*
+ * Start up a thread that reads and parses the text trace ahead of the 
+ * simulation. Binary traces are already decoded so they don't get one
+ */
+int traceStartReader(trace_reader *reader) {
+	if(reader->fin == NULL || reader->records != NULL || reader->ring != NULL)
+		return 0;
+	
+	trace_ring *ring;
+	if(posix_memalign((void **)&ring, 64, sizeof(trace_ring)) != 0)
+		return -1;
+	memset(ring, 0, sizeof(trace_ring));
+	reader->ring = ring;
+	if(pthread_create(&ring->thread, NULL, traceReaderThread, reader) != 0) {
+		free(ring);
+		reader->ring = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * The reader thread. Lines that aren't instructions go through the ring too, 
+ * since fetch counts them the same as it always has
+ */
+void *traceReaderThread(void *arg) {
+	trace_reader *reader = (trace_reader *)arg;
+	trace_ring *ring = reader->ring;
+	
+	uint64_t tail = 0;
+	trace_record rec;
+	int ret;
+	while((ret = traceDecodeNext(reader, &rec)) >= 0) {
+		// Wait for the simulation to make room. It takes a lot longer per 
+		// instruction than we do, so sleep instead of spinning on a core
+		while(tail - ring->head_cache == TRACE_RING_SIZE) {
+			if(__atomic_load_n(&ring->stop, __ATOMIC_ACQUIRE))
+				return NULL;
+			ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+			if(tail - ring->head_cache == TRACE_RING_SIZE) {
+				struct timespec wait = {0, 50000};
+				nanosleep(&wait, NULL);
+			}
+		}
+		
+		uint64_t slot = tail & (TRACE_RING_SIZE - 1);
+		ring->records[slot] = rec;
+		ring->status[slot] = ret;
+		tail++;
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	}
+	ring->error = (ret == -2);
+	__atomic_store_n(&ring->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/*
+ * Get rid of the reader thread, whether or not it got to the end of the trace
+ */
+void traceStopReader(trace_reader *reader) {
+	trace_ring *ring = reader->ring;
+	if(ring == NULL)
+		return;
+	__atomic_store_n(&ring->stop, 1, __ATOMIC_RELEASE);
+	pthread_join(ring->thread, NULL);
+	free(ring);
+	reader->ring = NULL;
+}
@@ -0,0 +1,86 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <inttypes.h>
+#include <stdio.h>
+
+/*
+ * Binary trace format. The file is a header followed by num_records fixed 
+ * width records, all in host byte order. The text traces can be converted 
+ * into this with procsim_convert, and the driver reads it back with mmap. 
+ * Version 2 keeps a placeholder record for every line that isn't an 
+ * instruction, since fetch spends a slot on those in a text trace too
+ */
+#define TRACE_MAGIC "PSTRACE"
+#define TRACE_VERSION 2
+
+typedef struct trace_header_t {
+	char magic[8]; // TRACE_MAGIC with the null terminator
+	uint32_t version;
+	uint32_t record_size; // sizeof(trace_record) of the writer
+	uint64_t num_records;
+} trace_header;
+
+/**
+ * One decoded instruction from the trace. Branch records (7 fields in the 
+ * text format) have branch set to 1 and taken set to 0 or 1. Everything 
+ * else has branch 0 and taken -1, just like the driver has always used. A 
+ * line that isn't an instruction gets a placeholder with branch set to 
+ * TRACE_NOT_INSTR, so in memory traces still line up with the text
+ */
+#define TRACE_NOT_INSTR -1
+
+typedef struct trace_record_t {
+	uint64_t address;
+	int32_t dest;
+	int32_t src1;
+	int32_t src2;
+	int8_t fu;
+	int8_t branch;
+	int8_t taken;
+	int8_t pad; // Keeps the record at 24 bytes
+} trace_record;
+
+struct trace_ring_t;
+
+/**
+ * A trace that we're reading from. Text traces are read a line at a time, 
+ * binary traces are mapped into memory and we just walk the records. A text 
+ * trace can also be decoded ahead of time by a reader thread, and then the 
+ * records come out of a ring that the thread keeps filled
+ */
+typedef struct trace_reader_t {
+	FILE *fin; // Text traces only
+	const trace_record *records; // Binary traces only
+	uint64_t num_records;
+	uint64_t next_record;
+	size_t map_size; // Size of the mapping if records points into a binary trace
+	int owns_records; // records was malloc'd by traceLoadAll
+	char *line; // getline buffer for text traces, grows to the longest line
+	size_t line_size;
+	struct trace_ring_t *ring; // Only while a reader thread is running
+} trace_reader;
+
+// Parse one line of a text trace. Returns 1 if it held an instruction, 
+// otherwise rec is the placeholder for the line
+int parseTraceLine(char *line, trace_record *rec);
+
+// Open/close traces for reading
+int traceOpenText(trace_reader *reader, FILE *fin);
+int traceOpenBinary(trace_reader *reader, const char *fileName);
+void traceClose(trace_reader *reader);
+
+// Decode the whole trace into memory once, then hand out read-only cursors 
+// over those records (one per simulation, they never modify the records)
+int traceLoadAll(trace_reader *reader);
+void traceShare(trace_reader *cursor, const trace_reader *shared);
+
+// Decode the trace on its own thread from here on (text traces only). 
+// traceNext keeps working the same way, it just reads from the ring instead
+int traceStartReader(trace_reader *reader);
+
+// Get the next record. Returns 1 if rec was filled, 0 if the line was not an 
+// instruction, -1 once the trace is done and -2 if the trace couldn't be read
+int traceNext(trace_reader *reader, trace_record *rec);
+
+#endif /* TRACE_H */
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "trace.h"
+
+/*
+ * Converts a text trace into the binary trace format that procsim can mmap. 
+ * Lines that aren't instructions are kept as placeholders, so a binary trace 
+ * simulates the same as the text one it came from
+ */
+
+void print_help_and_exit(void) {
+    printf("procsim_convert [OPTIONS] -o traces/file.ptrace < traces/file.trace\n");
+    printf("Lines that aren't instructions are kept, since fetch spends a slot on them\n");
+    printf("  -i I\t\tText trace to convert (default stdin)\n");
+    printf("  -o O\t\tBinary trace to write\n");
+    exit(0);
+}
+
+int main(int argc, char* argv[]) {
+    int opt;
+    FILE* fin = stdin;
+    FILE* fout = NULL;
+
+    while(-1 != (opt = getopt(argc, argv, "i:o:h"))) {
+        switch(opt) {
+            case 'i':
+                fin = fopen(optarg, "r");
+                if(fin == NULL) {
+                    fprintf(stderr, "Could not open %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'o':
+                fout = fopen(optarg, "wb");
+                if(fout == NULL) {
+                    fprintf(stderr, "Could not open %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'h':
+            default:
+                print_help_and_exit();
+                break;
+        }
+    }
+    if(fout == NULL) {
+        print_help_and_exit();
+    }
+
+	// Write a placeholder header first. We only know the record count at the end
+	trace_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+	header.version = TRACE_VERSION;
+	header.record_size = sizeof(trace_record);
+	fwrite(&header, sizeof(header), 1, fout);
+	
+	trace_reader reader;
+	traceOpenText(&reader, fin);
+	trace_record rec;
+	int ret;
+	uint64_t numInstrs = 0;
+	while((ret = traceNext(&reader, &rec)) >= 0) {
+		// Anything that isn't an instruction is written as a placeholder
+		fwrite(&rec, sizeof(rec), 1, fout);
+		header.num_records++;
+		numInstrs += ret;
+	}
+	traceClose(&reader);
+	if(ret == -2) {
+		fprintf(stderr, "Could not read the trace\n");
+		fclose(fout);
+		return -1;
+	}
+	
+	// Go back and fill in the real record count
+	if(fseek(fout, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, fout) != 1) {
+		fprintf(stderr, "Could not write the trace header\n");
+		fclose(fout);
+		return -1;
+	}
+	fclose(fout);
+	
+	printf("Converted %" PRIu64 " instructions\n", numInstrs);
+	return 0;
+}
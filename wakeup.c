@@ -0,0 +1,87 @@
+#include "wakeup.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define WAKEUP_X86 1
+#endif
+
+/*
+ * Function headers I need
+ */
+#ifdef WAKEUP_X86
+uint64_t wakeupMatchSSE2(const int64_t *tags, uint64_t live, const int64_t *broadcast, int numBroadcast);
+uint64_t wakeupMatchAVX2(const int64_t *tags, uint64_t live, const int64_t *broadcast, int numBroadcast);
+#endif
+
+/*
+ * Pick the kernel once, when a simulator gets set up. Every x86-64 CPU has 
+ * SSE2, AVX2 has to be checked for
+ */
+wakeup_kernel wakeupSelectKernel(void) {
+#ifdef WAKEUP_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		return wakeupMatchAVX2;
+	return wakeupMatchSSE2;
+#else
+	return wakeupMatchScalar;
+#endif
+}
+
+/*
+ * One tag at a time. This is what the vector kernels have to agree with
+ */
+uint64_t wakeupMatchScalar(const int64_t *tags, uint64_t live, const int64_t *broadcast, int numBroadcast) {
+	uint64_t mask = 0;
+	while(live != 0) {
+		int i = __builtin_ctzll(live);
+		for(int b = 0; b < numBroadcast; b++) {
+			if(tags[i] == broadcast[b]) {
+				mask |= 1ULL << i;
+				break;
+			}
+		}
+		live &= live - 1;
+	}
+	return mask;
+}
+
+#ifdef WAKEUP_X86
+/*
+ * Two tags per compare. SSE2 can only compare 32 bits at a time, so a 64 bit 
+ * lane matches when both of its halves do
+ */
+uint64_t wakeupMatchSSE2(const int64_t *tags, uint64_t live, const int64_t *broadcast, int numBroadcast) {
+	uint64_t mask = 0;
+	for(int i = 0; i < 64; i += 2) {
+		if(((live >> i) & 0x3) == 0)
+			continue;
+		__m128i slots = _mm_loadu_si128((const __m128i *)(tags + i));
+		__m128i any = _mm_setzero_si128();
+		for(int b = 0; b < numBroadcast; b++) {
+			__m128i eq = _mm_cmpeq_epi32(slots, _mm_set1_epi64x(broadcast[b]));
+			any = _mm_or_si128(any, _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1))));
+		}
+		mask |= (uint64_t)_mm_movemask_pd(_mm_castsi128_pd(any)) << i;
+	}
+	return mask & live;
+}
+
+/*
+ * Four tags per compare
+ */
+__attribute__((target("avx2")))
+uint64_t wakeupMatchAVX2(const int64_t *tags, uint64_t live, const int64_t *broadcast, int numBroadcast) {
+	uint64_t mask = 0;
+	for(int i = 0; i < 64; i += 4) {
+		if(((live >> i) & 0xF) == 0)
+			continue;
+		__m256i slots = _mm256_loadu_si256((const __m256i *)(tags + i));
+		__m256i any = _mm256_setzero_si256();
+		for(int b = 0; b < numBroadcast; b++)
+			any = _mm256_or_si256(any, _mm256_cmpeq_epi64(slots, _mm256_set1_epi64x(broadcast[b])));
+		mask |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(any)) << i;
+	}
+	return mask & live;
+}
+#endif
@@ -0,0 +1,20 @@
+#ifndef WAKEUP_H
+#define WAKEUP_H
+
+#include <inttypes.h>
+
+/**
+ * The tag match behind the scheduler's wakeup. A kernel compares up to 64 
+ * consecutive waiting source tags (the ones set in live) against every tag on 
+ * the result buses and gives back a bit per slot that matched any of them. There's a scalar one 
+ * that works anywhere plus SSE2 and AVX2 ones on x86, and they all give 
+ * exactly the same mask
+ */
+typedef uint64_t (*wakeup_kernel)(const int64_t *tags, uint64_t live, const int64_t *broadcast, int numBroadcast);
+
+// The fastest kernel this CPU can run
+wakeup_kernel wakeupSelectKernel(void);
+
+uint64_t wakeupMatchScalar(const int64_t *tags, uint64_t live, const int64_t *broadcast, int numBroadcast);
+
+#endif /* WAKEUP_H */